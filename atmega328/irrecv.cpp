@@ -0,0 +1,236 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/interrupt.h>
+
+#include "irrecv.h"
+#include "mtimer.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#if IR_PROTOCOL == IR_PROTOCOL_RC5
+static_assert(IR_RC5_HALF_MAX < IR_RC5_BIT_MIN, "RC5 half and full bit windows overlap at this tick length");
+#endif
+
+typedef enum {
+	IR_IDLE = 0,  // waiting for the first edge of a frame
+	IR_START,     // first edge seen, the next one tells frame from repeat
+	IR_DATA
+} IrState;
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static IrState irState = IR_IDLE;
+static uint16_t irLastEdge = 0;
+static uint32_t irShift = 0;
+static uint8_t irBits = 0;
+
+#if IR_PROTOCOL == IR_PROTOCOL_RC5
+static bool irMidBit = false; // last edge was in the middle of a bit
+static uint8_t irLastToggle = 0xFF;
+#endif
+
+// Last complete frame, repeats of it are reported with the same key
+static IrCode irLast;
+static uint64_t irLastFrameCicles = 0;
+
+// Single slot mailbox to the main loop, an unread key is overwritten
+static volatile IrCode irPending;
+static volatile bool irAvailable = false;
+
+static volatile uint16_t irErrors = 0;
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Arms input capture on the free-running Timer 1 set up by initTimer(), the
+ * prescaler is not touched. Falling edge first, the noise canceler filters
+ * glitches shorter than 4 cpu cicles.
+ */
+void initIR() {
+	_in(DDB0, DDRB);
+	_on(IR_PIN, PORTB); // pull-up, the receiver output idles high
+
+	TCCR1B = (TCCR1B & ~(1<<ICES1)) | (1<<ICNC1);
+	TIFR1 = (1<<ICF1);
+	_on(ICIE1, TIMSK1);
+}
+
+static void postCode(bool repeat) {
+	irLast.repeat = repeat;
+
+	irPending.protocol = irLast.protocol;
+	irPending.address = irLast.address;
+	irPending.command = irLast.command;
+	irPending.repeat = repeat;
+	irAvailable = true;
+
+	irLastFrameCicles = getCurrentTimeCicles();
+}
+
+static bool repeatAllowed() {
+	return (irLastFrameCicles != 0) && (getCurrentTimeCicles() - irLastFrameCicles < MS_TO_CICLES(IR_REPEAT_WINDOW_MS));
+}
+
+#if IR_PROTOCOL == IR_PROTOCOL_NEC
+
+/**
+ * NEC: every bit ends with a falling edge, the time between falling edges
+ * tells 0 from 1. 32 bits LSB first: address, ~address (or address high byte),
+ * command, ~command.
+ */
+static void decodeEdge(uint16_t period) {
+	switch (irState) {
+	case IR_IDLE:
+		irState = IR_START;
+		break;
+
+	case IR_START:
+		if (_between(period, IR_NEC_FRAME_START, 3)) {
+			irShift = 0;
+			irBits = 0;
+			irState = IR_DATA;
+		} else if (_between(period, IR_NEC_REPEAT_START, 3)) {
+			if (repeatAllowed()) {
+				postCode(true);
+			}
+			irState = IR_IDLE;
+		}
+		// Anything else: this edge may be the start of a frame, stay
+		break;
+
+	case IR_DATA:
+		irShift >>= 1;
+		if (_between(period, IR_NEC_BIT_1, 2)) {
+			irShift |= 0x80000000UL;
+		} else if (!_between(period, IR_NEC_BIT_0, 2)) {
+			irErrors++;
+			irState = IR_START; // may be the start of the next frame
+			break;
+		}
+
+		if (++irBits == IR_NEC_BITS) {
+			uint8_t command = irShift >> 16;
+			uint8_t inverted = irShift >> 24;
+
+			if ((uint8_t) (command ^ inverted) == 0xFF) {
+				uint8_t address = irShift;
+				uint8_t addressHigh = irShift >> 8;
+
+				irLast.protocol = IR_PROTOCOL_NEC;
+				irLast.address = ((uint8_t) (address ^ addressHigh) == 0xFF) ? address : (uint16_t) irShift;
+				irLast.command = command;
+				postCode(false);
+			} else {
+				irErrors++;
+			}
+			irState = IR_IDLE;
+		}
+		break;
+	}
+}
+
+#else
+
+/**
+ * RC5: Manchester coded, a falling edge in the middle of a bit is a 1 and a
+ * rising one a 0. Half bit periods move between bit middle and bit boundary,
+ * full bit periods go from middle to middle. 14 bits MSB first: 2 start bits,
+ * toggle, 5 bit system, 6 bit command.
+ */
+static void decodeEdge(uint16_t period, bool falling) {
+	if (irState == IR_IDLE) {
+		if (falling) {
+			// Middle of the first start bit (always 1)
+			irShift = 1;
+			irBits = 1;
+			irMidBit = true;
+			irState = IR_DATA;
+		}
+		return;
+	}
+
+	if ((period >= IR_RC5_HALF_MIN) && (period <= IR_RC5_HALF_MAX)) {
+		irMidBit = !irMidBit;
+		if (!irMidBit) {
+			return; // bit boundary, carries no data
+		}
+	} else if ((period < IR_RC5_BIT_MIN) || (period > IR_RC5_BIT_MAX) || !irMidBit) {
+		irErrors++;
+		irState = IR_IDLE;
+		if (falling) {
+			decodeEdge(0, true); // may be the start of the next frame
+		}
+		return;
+	}
+
+	irShift = (irShift << 1) | (falling ? 1 : 0);
+
+	if (++irBits == IR_RC5_BITS) {
+		uint8_t toggle = (irShift >> 11) & 0x01;
+		bool repeat = (toggle == irLastToggle) && repeatAllowed();
+
+		irLast.protocol = IR_PROTOCOL_RC5;
+		irLast.address = (irShift >> 6) & 0x1F;
+		irLast.command = irShift & 0x3F;
+		irLastToggle = toggle;
+		postCode(repeat);
+
+		irState = IR_IDLE;
+	}
+}
+
+#endif
+
+/**
+ * Input capture interrupt, called from ISR(TIMER1_CAPT_vect). AVR interrupts
+ * do not nest, the radio and USART interrupts wait until it returns: a 32 bit
+ * shift and a few compares per edge, the last edge of a frame also reads and
+ * compares the 64 bit timebase (a few hundred cicles, ~100 us at 4 Mhz).
+ */
+void handleIRCapture() {
+	uint16_t edge = ICR1;
+	uint16_t period = edge - irLastEdge; // wraps with the timer
+	irLastEdge = edge;
+
+#if IR_PROTOCOL == IR_PROTOCOL_NEC
+	decodeEdge(period);
+#else
+	bool falling = !(TCCR1B & (1<<ICES1));
+	TCCR1B ^= (1<<ICES1); // both edges
+	TIFR1 = (1<<ICF1);    // changing the edge may set the flag
+
+	// A long gap ends any frame in progress
+	if (period > IR_RC5_BIT_MAX + 2) {
+		irState = IR_IDLE;
+	}
+	decodeEdge(period, falling);
+#endif
+}
+
+/**
+ * Takes the last decoded key, false if there is none.
+ */
+bool readIRCode(IrCode *code) {
+	uint8_t sreg = SREG;
+	cli();
+
+	bool available = irAvailable;
+	if (available) {
+		code->protocol = irPending.protocol;
+		code->address = irPending.address;
+		code->command = irPending.command;
+		code->repeat = irPending.repeat;
+		irAvailable = false;
+	}
+
+	SREG = sreg;
+	return available;
+}
+
+uint16_t getIRErrorCount() {
+	return irErrors;
+}
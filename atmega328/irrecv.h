@@ -0,0 +1,65 @@
+#ifndef IRRECV_H_
+#define IRRECV_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define IR_PROTOCOL_NEC 0
+#define IR_PROTOCOL_RC5 1
+
+#define IR_PROTOCOL IR_PROTOCOL_NEC
+
+// Demodulating receiver (TSOP type, active low) on ICP1
+#define IR_PIN PB0
+
+// Timer 1 cicles (clkI/O/1024 at 4 Mhz, 256 us each) in the given microseconds, rounded
+#define IR_TICKS(us) ((uint16_t) (((uint32_t) (us) * 15625UL + 2000000UL) / 4000000UL))
+
+// NEC, falling edge to falling edge
+#define IR_NEC_FRAME_START  IR_TICKS(13500) // 9 ms mark + 4.5 ms space
+#define IR_NEC_REPEAT_START IR_TICKS(11250) // 9 ms mark + 2.25 ms space
+#define IR_NEC_BIT_0        IR_TICKS(1125)
+#define IR_NEC_BIT_1        IR_TICKS(2250)
+#define IR_NEC_BITS         32
+
+// Bounds of a period in ticks: the edges are stamped to a tick, so d us read as floor or ceil of d / 256 us
+#define IR_TICKS_FLOOR(us) ((uint16_t) ((uint32_t) (us) * 15625UL / 4000000UL))
+#define IR_TICKS_CEIL(us)  ((uint16_t) (((uint32_t) (us) * 15625UL + 3999999UL) / 4000000UL))
+
+// RC5, between any two edges. Receivers stretch or shorten marks by up to
+// IR_RC5_TOLERANCE_US, so half bits read 2..5 ticks and full bits 6..8.
+#define IR_RC5_TOLERANCE_US 150
+#define IR_RC5_HALF_MIN IR_TICKS_FLOOR(889 - IR_RC5_TOLERANCE_US)
+#define IR_RC5_HALF_MAX IR_TICKS_CEIL(889 + IR_RC5_TOLERANCE_US)
+#define IR_RC5_BIT_MIN  IR_TICKS_FLOOR(1778 - IR_RC5_TOLERANCE_US)
+#define IR_RC5_BIT_MAX  IR_TICKS_CEIL(1778 + IR_RC5_TOLERANCE_US)
+#define IR_RC5_BITS     14
+
+// A repeat only counts if the previous frame is at most this old (NEC repeats every 108 ms, RC5 every 114 ms)
+#define IR_REPEAT_WINDOW_MS 150
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint8_t protocol; // IR_PROTOCOL_*
+	uint16_t address; // NEC: 8 bit, or 16 bit for extended remotes. RC5: 5 bit system
+	uint8_t command;
+	bool repeat;      // key held down
+} IrCode;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void initIR();
+void handleIRCapture();
+bool readIRCode(IrCode *code);
+uint16_t getIRErrorCount();
+
+#endif /* IRRECV_H_ */
@@ -0,0 +1,72 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include "meminfo.h"
+
+/********************************************************************************
+	Linker Symbols
+********************************************************************************/
+extern uint8_t __data_start;
+extern uint8_t __data_end;
+extern uint8_t __bss_start;
+extern uint8_t __bss_end;
+extern uint8_t __heap_start;
+extern void *__brkval;
+
+/********************************************************************************
+	Stack Painting
+********************************************************************************/
+/**
+ * Fills everything between the end of .bss and the top of the stack with
+ * STACK_PAINT_PATTERN. Runs from .init1, before the stack pointer and r1 are
+ * set up, so it must not touch the stack nor rely on any C runtime state.
+ */
+void paintStack(void) __attribute__ ((naked, used, section (".init1")));
+
+void paintStack(void) {
+	__asm volatile (
+		"    ldi r30, lo8(_end)     \n"
+		"    ldi r31, hi8(_end)     \n"
+		"    ldi r24, %0            \n"
+		"    ldi r25, hi8(__stack)  \n"
+		"    rjmp 2f                \n"
+		"1:  st Z+, r24             \n"
+		"2:  cpi r30, lo8(__stack)  \n"
+		"    cpc r31, r25           \n"
+		"    brlo 1b                \n"
+		"    breq 1b                \n"
+		:: "M" (STACK_PAINT_PATTERN));
+}
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Returns the first address above .bss/heap which is not used by malloc.
+ */
+static uint8_t *getHeapEnd() {
+	return (__brkval == 0) ? &__heap_start : (uint8_t *) __brkval;
+}
+
+/**
+ * Collects section sizes and the stack high-water mark.
+ * The high-water mark is the lowest address whose paint was overwritten,
+ * so it also covers ISR frames nested on top of the deepest main() call.
+ */
+void getMemoryInfo(MemoryInfo *info) {
+	uint8_t *heapEnd = getHeapEnd();
+	uint8_t *sp = (uint8_t *) (uintptr_t) SP;
+
+	uint8_t *peak = heapEnd;
+	while ((peak <= sp) && (*peak == STACK_PAINT_PATTERN)) {
+		peak++;
+	}
+
+	info->dataSize = &__data_end - &__data_start;
+	info->bssSize = &__bss_end - &__bss_start;
+	info->heapSize = heapEnd - &__heap_start;
+	info->stackSize = RAMEND - (uintptr_t) sp;
+	info->stackPeak = RAMEND + 1 - (uintptr_t) peak;
+	info->headroom = peak - heapEnd;
+	info->freeNow = sp - heapEnd;
+}
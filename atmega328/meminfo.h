@@ -0,0 +1,34 @@
+#ifndef MEMINFO_H_
+#define MEMINFO_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+// Pattern written over free SRAM by paintStack() before main() runs.
+#define STACK_PAINT_PATTERN 0xC5
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint16_t dataSize;    // .data section size
+	uint16_t bssSize;     // .bss section size
+	uint16_t heapSize;    // bytes handed out by malloc (0 if unused)
+	uint16_t stackSize;   // current stack depth
+	uint16_t stackPeak;   // deepest stack seen since reset (high-water mark)
+	uint16_t headroom;    // never touched bytes between heap and stack peak
+	uint16_t freeNow;     // bytes between heap and current stack pointer
+} MemoryInfo;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void getMemoryInfo(MemoryInfo *info);
+
+#endif /* MEMINFO_H_ */
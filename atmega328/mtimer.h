@@ -10,6 +10,9 @@ Includes
 ********************************************************************************/
 #define _to_uint64(x,y) ((uint64_t) x << 16) | y
 
+// Timer 1 cicles (clkI/O/1024 at 4 Mhz, 3906.25 per second) in the given milliseconds
+#define MS_TO_CICLES(ms) ((uint32_t) (ms) * 390625UL / 100000UL)
+
 /********************************************************************************
 Function Prototypes
 ********************************************************************************/
@@ -0,0 +1,251 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+
+#include "potspi.h"
+#include "mtimer.h"
+#include "../nrf24l01/atmega328.h"
+
+extern "C" {
+#include "usart.h"
+}
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define POT_BENCH_WRITES 256
+#define POT_BENCH_CHUNK  8  // writes per interrupt-free run, ~6.5 ms bit-banged at 4 MHz, below the 65536 cicles Timer 1 counts at clk/1
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+// Last word sent, the benchmark repeats it so the pot does not move
+static uint16_t potLastWord = 0;
+
+/********************************************************************************
+	Bit-bang Driver
+********************************************************************************/
+void initPotBitBang() {
+	_out(DDC0, DDRC); // SI
+	_out(DDC1, DDRC); // SCK
+	_out(DDC2, DDRC); // CSN
+
+	_on(POT_CS, PORTC); // Default disable CSN
+	_off(POT_SCK, PORTC); // SCK default 0
+}
+
+void potBitBangWrite(uint16_t data) {
+	_off(POT_CS, PORTC); // Enable CSN
+
+	uint8_t i = 15;
+	do {
+		_off(POT_SCK, PORTC); // 0 -> SCK
+
+		_delay_loop_1(10);
+
+		if (GET_REG1_FLAG(data, i)) {
+			_on(POT_SI, PORTC); // 1 -> SI
+		} else {
+			_off(POT_SI, PORTC); // 0 -> SI
+		}
+
+		_delay_loop_1(10);
+
+		_on(POT_SCK, PORTC); // 1 -> SCK
+		_delay_loop_1(40);
+	} while (i--);
+
+	_off(POT_SCK, PORTC); // 0 -> SCK
+	_delay_loop_1(40);
+
+	_off(POT_SI, PORTC); // 0 -> SI
+	_on(POT_CS, PORTC); // Disable CSN
+	_delay_loop_1(5);
+
+	potLastWord = data;
+}
+
+/********************************************************************************
+	Hardware SPI Driver
+********************************************************************************/
+/**
+ * Uses the SPI unit set up for the nRF24L01 by setup_spi() (mode 0, fck/2),
+ * only the chip select is added.
+ */
+void initPotHwSpi() {
+	_out(DDC2, DDRC);
+	_on(POT_CS, PORTC);
+
+	setup_io();
+	setup_spi();
+}
+
+/**
+ * The radio is accessed from ISR(INT0_vect), masking INT0 for the two bytes
+ * keeps its transactions and ours apart. The main loop never talks to the
+ * radio while it writes the pot.
+ */
+void potHwSpiWrite(uint16_t data) {
+	uint8_t radioIrq = EIMSK & _BV(INT0);
+	_off(INT0, EIMSK);
+
+	_off(POT_CS, PORTC);
+	transfer_spi(data >> 8);
+	transfer_spi(data & 0xFF);
+	_on(POT_CS, PORTC);
+
+	EIMSK |= radioIrq;
+
+	potLastWord = data;
+}
+
+/********************************************************************************
+	USART MSPIM Driver
+********************************************************************************/
+void initPotMspim() {
+	_out(DDC2, DDRC);
+	_on(POT_CS, PORTC);
+
+	// XCK as output selects master mode
+	UBRR0 = 0;
+	_out(POT_XCK, DDRD);
+
+	// Master SPI, mode 0, MSB first
+	UCSR0C = (1<<UMSEL01)|(1<<UMSEL00)|(0<<UCPHA0)|(0<<UCPOL0);
+	UCSR0B = (1<<TXEN0);
+
+	// Baud rate must be set after the transmitter is enabled, fosc/2
+	UBRR0 = 0;
+}
+
+void potMspimWrite(uint16_t data) {
+	_off(POT_CS, PORTC);
+
+	// Clear TXC, then queue both bytes (the transmitter is double buffered)
+	UCSR0A = (1<<TXC0);
+	UDR0 = data >> 8;
+	while (!(UCSR0A & (1<<UDRE0)));
+	UDR0 = data & 0xFF;
+
+	// Chip select may only rise once the last bit is out
+	while (!(UCSR0A & (1<<TXC0)));
+	_on(POT_CS, PORTC);
+
+	potLastWord = data;
+}
+
+/********************************************************************************
+	Selected Driver
+********************************************************************************/
+void initPot() {
+#if POT_DRIVER == POT_DRIVER_HWSPI
+	initPotHwSpi();
+#elif POT_DRIVER == POT_DRIVER_MSPIM
+	initPotMspim();
+#else
+	initPotBitBang();
+#endif
+}
+
+void potWrite(uint16_t data) {
+#if POT_DRIVER == POT_DRIVER_HWSPI
+	potHwSpiWrite(data);
+#elif POT_DRIVER == POT_DRIVER_MSPIM
+	potMspimWrite(data);
+#else
+	potBitBangWrite(data);
+#endif
+}
+
+/********************************************************************************
+	Benchmark
+********************************************************************************/
+/**
+ * Cpu cicles per write, from POT_BENCH_WRITES writes. Runs in chunks of
+ * POT_BENCH_CHUNK writes with interrupts off, the watchdog is fed and pending
+ * interrupts are served in between (not timed).
+ *
+ * Each chunk is timed with Timer 1 switched to clk/1, exact to the few cicles
+ * of starting and stopping it (well under one per write). The time base is
+ * paused meanwhile and advanced by the chunk afterwards, an IR edge in a
+ * chunk is lost.
+ */
+static uint16_t benchPotWrite(void (*write)(uint16_t)) {
+	const uint8_t clockBits = (1<<CS12)|(1<<CS11)|(1<<CS10);
+	uint16_t data = potLastWord;
+	uint32_t cicles = 0;
+	uint16_t carry = 0; // cicles not handed back to the time base yet
+
+	for (uint16_t chunk = 0; chunk < POT_BENCH_WRITES / POT_BENCH_CHUNK; chunk++) {
+		wdt_reset();
+
+		uint8_t sreg = SREG;
+		cli();
+
+		uint8_t clock = TCCR1B;
+		uint16_t now = TCNT1;
+
+		TCCR1B = clock & ~clockBits;
+		TCNT1 = 0;
+		TCCR1B = (clock & ~clockBits) | (1<<CS10);
+		for (uint8_t i = 0; i < POT_BENCH_CHUNK; i++) {
+			write(data);
+		}
+		TCCR1B = clock & ~clockBits;
+		uint16_t elapsed = TCNT1;
+		cicles += elapsed;
+
+		// Whole ticks of 1024 cicles, never past TOP: the overflow would be lost
+		uint32_t pending = (uint32_t) carry + elapsed;
+		uint16_t ticks = pending >> 10;
+		carry = pending & 1023;
+		if (ticks > (uint16_t) (0xFFFF - now)) {
+			ticks = 0xFFFF - now;
+		}
+		TCNT1 = now + ticks;
+		TCCR1B = clock;
+
+		SREG = sreg;
+	}
+
+	return (uint16_t) (cicles / POT_BENCH_WRITES);
+}
+
+/**
+ * Times the drivers, each rewriting the last word sent. Pins are left
+ * configured for POT_DRIVER.
+ *
+ * Unless it is the selected driver, MSPIM is only timed with withMspim: it
+ * borrows USART0 from the console, so the host receives the pot words as
+ * garbage on TXD and PD4 (XCK) is driven for the duration.
+ */
+void benchPotDrivers(PotBenchResult *result, bool withMspim) {
+	initPotBitBang();
+	result->bitbang = benchPotWrite(potBitBangWrite);
+
+	initPotHwSpi();
+	result->hwspi = benchPotWrite(potHwSpiWrite);
+
+	result->mspim = 0;
+#if POT_DRIVER == POT_DRIVER_MSPIM
+	(void) withMspim;
+	initPotMspim();
+	result->mspim = benchPotWrite(potMspimWrite);
+#else
+	if (withMspim) {
+		// Let the console drain before taking the USART
+		usart_drain();
+
+		initPotMspim();
+		result->mspim = benchPotWrite(potMspimWrite);
+
+		_off(POT_XCK, DDRD);
+		usart_init();
+	}
+#endif
+
+	initPot();
+}
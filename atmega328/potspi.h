@@ -0,0 +1,68 @@
+#ifndef POTSPI_H_
+#define POTSPI_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+/*
+ * Serial-out drivers for the digital pot (16 bit words, SPI mode 0, MSB first).
+ * Chip select is PC2 for all of them.
+ *
+ *   POT_DRIVER_BITBANG  SI on PC0, SCK on PC1, timed by _delay_loop_1
+ *   POT_DRIVER_HWSPI    MOSI (PB3) and SCK (PB5) shared with the nRF24L01
+ *   POT_DRIVER_MSPIM    USART0 in master SPI mode, TXD (PD1) and XCK (PD4).
+ *                       The ATmega328 has a single USART, so there is no console.
+ */
+#define POT_DRIVER_BITBANG 0
+#define POT_DRIVER_HWSPI   1
+#define POT_DRIVER_MSPIM   2
+
+#define POT_DRIVER POT_DRIVER_BITBANG
+
+#define POT_CS   PC2
+#define POT_SI   PC0
+#define POT_SCK  PC1
+#define POT_XCK  PD4
+
+// Command byte (high byte of the word): write data to pot 0, pot 1 or both
+#define POT_CMD_WRITE 0b00010000
+#define POT_SELECT_0  0b00000001
+#define POT_SELECT_1  0b00000010
+#define POT_WORD(select, wiper) ((((uint16_t) (POT_CMD_WRITE | (select))) << 8) | (uint8_t) (wiper))
+
+#define POT_WIPER_MAX 255
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint16_t bitbang;  // cpu cicles per write, 0 if not measured
+	uint16_t hwspi;
+	uint16_t mspim;
+} PotBenchResult;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void initPotBitBang();
+void potBitBangWrite(uint16_t data);
+
+void initPotHwSpi();
+void potHwSpiWrite(uint16_t data);
+
+void initPotMspim();
+void potMspimWrite(uint16_t data);
+
+void initPot();
+void potWrite(uint16_t data);
+
+void benchPotDrivers(PotBenchResult *result, bool withMspim);
+
+#endif /* POTSPI_H_ */
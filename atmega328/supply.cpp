@@ -0,0 +1,140 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <util/atomic.h>
+
+#include "supply.h"
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static volatile uint16_t supplyAdc = 0;
+static volatile bool powerFailArmed = false; // set once calibrated and trusted
+static volatile bool powerFailPending = false;
+static volatile uint8_t powerFailCount = 0;
+
+// Conversions ignored after start, the bandgap needs ~70 us to settle
+static volatile uint8_t settleSamples = 4;
+
+// Boot calibration: sum of the first readings, then the thresholds derived from it
+static volatile uint8_t calibrateSamples = SUPPLY_CALIBRATE_SAMPLES;
+static uint16_t calibrateSum = 0;
+static volatile uint16_t bootAdc = 0;
+static uint16_t failAdc = 0;
+static uint16_t restoreAdc = 0;
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+static uint16_t adcToMillivolts(uint16_t adc) {
+	return (adc == 0) ? 0 : (uint16_t) ((uint32_t) BANDGAP_MV * 1024 / adc);
+}
+
+/**
+ * Measures the 1.1V bandgap against AVcc with the ADC in free running mode.
+ * clkI/O/128 gives one conversion every ~416 us at 4 Mhz, so a falling supply
+ * is noticed well within the hold-up time of the supply capacitors. The
+ * first SUPPLY_CALIBRATE_SAMPLES readings give the nominal supply.
+ */
+void initSupplyMonitor() {
+	// AVcc reference, bandgap input (MUX = 1110)
+	ADMUX = (0<<REFS1)|(1<<REFS0)|(1<<MUX3)|(1<<MUX2)|(1<<MUX1)|(0<<MUX0);
+
+	// Free running
+	ADCSRB = 0;
+
+	// Enable, auto trigger, interrupt, prescaler 128, start
+	ADCSRA = (1<<ADEN)|(1<<ADATE)|(1<<ADIE)|(1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0)|(1<<ADSC);
+}
+
+/**
+ * Called from ISR(ADC_vect). Flags a power fail once per supply dip for
+ * takePowerFail(), it is armed again only after the supply recovered with
+ * some hysteresis. Returns true on the conversion that saw the fail, so the
+ * handler can save what matters most right away.
+ */
+bool handleSupplyInterrupt() {
+	uint16_t adc = ADC;
+
+	if (settleSamples > 0) {
+		settleSamples--;
+		return false;
+	}
+
+	supplyAdc = adc;
+
+	if (calibrateSamples > 0) {
+		calibrateSum += adc;
+		if (--calibrateSamples == 0) {
+			uint16_t nominal = calibrateSum / SUPPLY_CALIBRATE_SAMPLES;
+			uint16_t mv = adcToMillivolts(nominal);
+
+			bootAdc = nominal;
+			if ((mv >= SUPPLY_MIN_MV) && (mv <= SUPPLY_MAX_MV)) {
+				// The reading rises as AVcc falls
+				failAdc = (uint16_t) ((uint32_t) nominal * 100 / SUPPLY_FAIL_PERCENT);
+				restoreAdc = (uint16_t) ((uint32_t) nominal * 100 / SUPPLY_RESTORE_PERCENT);
+				powerFailArmed = true;
+			}
+		}
+		return false;
+	}
+
+	if (failAdc == 0) {
+		return false; // untrusted boot reading, no monitoring
+	}
+
+	if (powerFailArmed && (adc > failAdc)) {
+		powerFailArmed = false;
+		powerFailPending = true;
+		powerFailCount++;
+		return true;
+	} else if (!powerFailArmed && (adc < restoreAdc)) {
+		powerFailArmed = true;
+	}
+	return false;
+}
+
+/**
+ * True once per power fail, for the main loop to save the state.
+ */
+bool takePowerFail() {
+	bool pending;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		pending = powerFailPending;
+		powerFailPending = false;
+	}
+	return pending;
+}
+
+/**
+ * False while calibrating, when the boot reading was not trusted, or when
+ * the monitor was never started: nothing saves the state at power-off then.
+ */
+bool isSupplyMonitored() {
+	bool monitored;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		monitored = (failAdc != 0);
+	}
+	return monitored;
+}
+
+uint16_t getSupplyMillivolts() {
+	uint16_t adc;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		adc = supplyAdc;
+	}
+	return adcToMillivolts(adc);
+}
+
+uint16_t getBootSupplyMillivolts() {
+	uint16_t adc;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		adc = bootAdc;
+	}
+	return adcToMillivolts(adc);
+}
+
+uint8_t getPowerFailCount() {
+	return powerFailCount;
+}
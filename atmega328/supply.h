@@ -0,0 +1,45 @@
+#ifndef SUPPLY_H_
+#define SUPPLY_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define BANDGAP_MV 1100
+
+// Thresholds relative to AVcc measured at boot, the board may run at 5 V or 3.3 V.
+// Below the fail level the power-fail save starts, above the restore level it is re-armed.
+#define SUPPLY_FAIL_PERCENT    86 // 4.3 V at 5 V, 2.84 V at 3.3 V
+#define SUPPLY_RESTORE_PERCENT 90
+#define SUPPLY_CALIBRATE_SAMPLES 8
+
+// A boot reading outside this range (supply not up yet, bandgap off) is not trusted,
+// the monitor then stays off and isSupplyMonitored() is false
+#define SUPPLY_MIN_MV 2700
+#define SUPPLY_MAX_MV 5500
+
+#if SUPPLY_FAIL_PERCENT >= SUPPLY_RESTORE_PERCENT || SUPPLY_RESTORE_PERCENT >= 100
+#error "need SUPPLY_FAIL_PERCENT < SUPPLY_RESTORE_PERCENT < 100"
+#endif
+
+// ADC reading of the bandgap against AVcc at the given supply voltage (rises as AVcc falls)
+#define SUPPLY_ADC(mv) ((uint16_t) ((uint32_t) BANDGAP_MV * 1024 / (mv)))
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void initSupplyMonitor();
+bool handleSupplyInterrupt();
+bool takePowerFail();
+bool isSupplyMonitored();
+uint16_t getSupplyMillivolts();
+uint16_t getBootSupplyMillivolts();
+uint8_t getPowerFailCount();
+
+#endif /* SUPPLY_H_ */
@@ -3,12 +3,36 @@ Includes
 ********************************************************************************/
 #include "usart.h"
 #include <string.h>
+#include <ctype.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
 
 /********************************************************************************
 Internal Function Prototypes
 ********************************************************************************/
 void parse_usart_cmd();
 
+/********************************************************************************
+Baud Table
+********************************************************************************/
+typedef struct {
+	uint32_t baud;
+	uint16_t ubrr;
+	uint8_t u2x;
+	uint8_t error; // per mille, saturated
+} usart_baud_t;
+
+#define USART_BAUD_ERROR(baud) (USART_ERROR(baud, USART_U2X(baud)) > 255 ? 255 : USART_ERROR(baud, USART_U2X(baud)))
+#define USART_BAUD_ENTRY(baud) { baud, USART_UBRR(baud), USART_U2X(baud), USART_BAUD_ERROR(baud) },
+#define USART_BAUD_CHECK(baud) _Static_assert(USART_UBRR(baud) <= 0x0FFF, "UBRR of " #baud " baud out of range");
+
+static const usart_baud_t usart_bauds[] PROGMEM = { USART_BAUD_RATES(USART_BAUD_ENTRY) };
+
+USART_BAUD_RATES(USART_BAUD_CHECK)
+_Static_assert(USART_ERROR(BAUD, USART_U2X(BAUD)) <= USART_BAUD_TOLERANCE, "BAUD not reachable from F_CPU");
+
 /********************************************************************************
 Global Variables
 ********************************************************************************/
@@ -18,25 +42,149 @@ volatile uint8_t usart_reg1_flags = 0;
 volatile uint8_t usart_cmd_buffer[255];
 volatile uint8_t usart_cmd_buffer_count = 0;
 
+// Binary frame receiver
+enum { FRAME_TEXT = 0, FRAME_LEN, FRAME_DATA, FRAME_SKIP };
+volatile uint8_t usart_frame_state = FRAME_TEXT;
+volatile uint8_t usart_frame[USART_FRAME_MAX + 1]; // type, body, crc
+volatile uint8_t usart_frame_len = 0;
+volatile uint8_t usart_frame_count = 0;
+volatile uint16_t usart_frame_error_count = 0;
+volatile uint16_t usart_frame_stamp = 0; // TCNT1 at the last frame byte
+
+// Line setting in use, usart_init() restores it after the pot took the USART (MSPIM)
+static uint32_t usart_baud = BAUD;
+static uint16_t usart_ubrr = USART_UBRR(BAUD);
+static uint8_t usart_u2x = USART_U2X(BAUD);
+static uint8_t usart_format = USART_DEFAULT_FORMAT;
+static volatile bool usart_tx_pending = false; // TXC is only meaningful once something was sent
+
 void usart_init() {
-    // Set baud rate
-    UBRR0H = (uint8_t)((MYUBRR)>>8);
-    UBRR0L = (uint8_t)(MYUBRR);
+    // Set baud rate, double speed when that is closer
+    UCSR0A = usart_u2x ? (1<<U2X0) : 0;
+    UBRR0H = (uint8_t)(usart_ubrr>>8);
+    UBRR0L = (uint8_t)(usart_ubrr);
 
     // Enable receiver and transmitter and Interrupt on receive complete
     UCSR0B = (1<<RXEN0)|(1<<TXEN0)|(1<<RXCIE0);
 
-    // Set frame format: 8data, 2stop bit, Odd Parity
-    UCSR0C = (1<<UPM01)|(1<<UPM00)|(1<<USBS0)|(1<<UCSZ01)|(1<<UCSZ00);
+    // Set frame format: 8data, parity and stop bits as configured (8O2 by default)
+    UCSR0C = usart_format|(1<<UCSZ01)|(1<<UCSZ00);
 
     // setup our stdio stream
     stdout = &mystdout;
 }
 
+/**
+ * Switches the line to one of the table rates, false (nothing changed) for a
+ * rate not in the table, out of tolerance or a reserved parity mode. Waits
+ * for the pending output to go out at the old setting first.
+ */
+bool usart_configure(uint32_t baud, uint8_t format) {
+	if ((format & ~USART_FORMAT_MASK) || ((format & USART_FORMAT_8O1) == (1<<UPM00))) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < usart_baud_count(); i++) {
+		uint8_t error;
+		bool u2x;
+		if (usart_baud_rate(i, &error, &u2x) != baud) {
+			continue;
+		}
+		if (error > USART_BAUD_TOLERANCE) {
+			return false;
+		}
+
+		usart_drain();
+		usart_baud = baud;
+		usart_ubrr = pgm_read_word(&usart_bauds[i].ubrr);
+		usart_u2x = u2x;
+		usart_format = format;
+		usart_init();
+		return true;
+	}
+	return false;
+}
+
+uint32_t usart_get_baud() {
+	return usart_baud;
+}
+
+uint8_t usart_get_format() {
+	return usart_format;
+}
+
+/**
+ * Returns once the last byte left the shift register.
+ */
+void usart_drain() {
+	if (usart_tx_pending) {
+		while ( !(UCSR0A & (_BV(TXC0))) ) {
+			wdt_reset();
+		}
+		usart_tx_pending = false;
+	}
+}
+
+uint8_t usart_baud_count() {
+	return sizeof(usart_bauds) / sizeof(usart_bauds[0]);
+}
+
+/**
+ * Rate of a table entry with its error and divider, 0 past the end.
+ */
+uint32_t usart_baud_rate(uint8_t index, uint8_t *error, bool *u2x) {
+	if (index >= usart_baud_count()) {
+		return 0;
+	}
+	*error = pgm_read_byte(&usart_bauds[index].error);
+	*u2x = pgm_read_byte(&usart_bauds[index].u2x);
+	return pgm_read_dword(&usart_bauds[index].baud);
+}
+
+/**
+ * "8N1", "8e2"... to a USART_FORMAT_*, -1 if not understood.
+ */
+int16_t usart_parse_format(const char *name) {
+	if ((strlen(name) != 3) || (name[0] != '8')) {
+		return -1;
+	}
+
+	int16_t format;
+	switch (toupper(name[1])) {
+		case 'N': format = 0; break;
+		case 'E': format = (1<<UPM01); break;
+		case 'O': format = (1<<UPM01)|(1<<UPM00); break;
+		default: return -1;
+	}
+
+	switch (name[2]) {
+		case '1': return format;
+		case '2': return format | (1<<USBS0);
+		default: return -1;
+	}
+}
+
+/**
+ * Writes the "8N1" form of a USART_FORMAT_*, name holds 4 chars.
+ */
+void usart_format_name(uint8_t format, char *name) {
+	name[0] = '8';
+	name[1] = (format & (1<<UPM01)) ? ((format & (1<<UPM00)) ? 'O' : 'E') : 'N';
+	name[2] = (format & (1<<USBS0)) ? '2' : '1';
+	name[3] = 0;
+}
+
 void usart_putchar(char data) {
+    // Long console dumps (printDetails, scan) must not trip the watchdog
+    wdt_reset();
+
     // Wait for empty transmit buffer
     while ( !(UCSR0A & (_BV(UDRE0))) );
 
+    // Clear TXC for usart_drain(), keeping the speed bit (error flags must be written 0)
+    UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+    usart_tx_pending = true;
+
     // Start transmission
     UDR0 = data;
 }
@@ -73,9 +221,68 @@ int usart_putchar_printf(char var, FILE *stream) {
     return 0;
 }
 
+/**
+ * Collects a binary frame, no echo. A length out of range drops back to text
+ * mode right away, a frame arriving before the previous one was handled is
+ * dropped.
+ */
+static void handle_usart_frame_byte(uint8_t usart_data) {
+	usart_frame_stamp = TCNT1;
+
+	if (usart_frame_state == FRAME_LEN) {
+		if ((usart_data == 0) || (usart_data > USART_FRAME_MAX)) {
+			usart_frame_error_count++;
+			usart_frame_state = FRAME_TEXT;
+			return;
+		}
+		usart_frame_count = usart_data + 1;
+		if (GET_REG1_FLAG(usart_reg1_flags, UART_FRAME_RECEIVED)) {
+			// Previous frame not handled yet, swallow this one
+			usart_frame_error_count++;
+			usart_frame_state = FRAME_SKIP;
+			return;
+		}
+		usart_frame_len = usart_data;
+		usart_frame_count = 0;
+		usart_frame_state = FRAME_DATA;
+		return;
+	}
+
+	if (usart_frame_state == FRAME_SKIP) {
+		if (--usart_frame_count == 0) {
+			usart_frame_state = FRAME_TEXT;
+		}
+		return;
+	}
+
+	usart_frame[usart_frame_count++] = usart_data;
+
+	// type + body, then the crc
+	if (usart_frame_count == usart_frame_len + 1) {
+		SET_REG1_FLAG(usart_reg1_flags, UART_FRAME_RECEIVED);
+		usart_frame_state = FRAME_TEXT;
+	}
+}
+
 void handle_usart_interrupt() {
 	uint8_t usart_data = UDR0;
 
+	if (usart_frame_state != FRAME_TEXT) {
+		handle_usart_frame_byte(usart_data);
+		return;
+	}
+
+	// Sync byte selects a binary frame. Never typed, so a partial text line is
+	// dropped; a command line still waiting for the main loop is kept.
+	if (usart_data == USART_SYNC) {
+		if (!(GET_REG1_FLAG(usart_reg1_flags, UART_CMD_RECEIVED))) {
+			usart_cmd_buffer_count = 0;
+		}
+		usart_frame_stamp = TCNT1;
+		usart_frame_state = FRAME_LEN;
+		return;
+	}
+
 	switch (usart_data) {
 		case 13:
 			SET_REG1_FLAG(usart_reg1_flags, UART_CMD_RECEIVED);
@@ -93,6 +300,17 @@ void handle_usart_interrupt() {
 
 void usart_check_loop() {
 
+	/**
+	 * --------> USART Binary frame stalled.
+	 */
+	uint8_t sreg = SREG;
+	cli();
+	if ((usart_frame_state != FRAME_TEXT) && ((uint16_t) (TCNT1 - usart_frame_stamp) > USART_FRAME_TIMEOUT_TICKS)) {
+		usart_frame_state = FRAME_TEXT;
+		usart_frame_error_count++;
+	}
+	SREG = sreg;
+
 	/**
 	 * --------> USART Unsupported command received.
 	 */
@@ -103,6 +321,26 @@ void usart_check_loop() {
 		CLR_REG1_FLAG(usart_reg1_flags, UNSUPPORTED_CMD_RECEIVED);
 	}
 
+	/**
+	 * --------> USART Binary frame received.
+	 */
+	if (GET_REG1_FLAG(usart_reg1_flags, UART_FRAME_RECEIVED)) {
+		uint8_t len = usart_frame_len;
+		uint8_t crc = _crc_ibutton_update(0, len);
+		for (uint8_t i = 0; i < len; i++) {
+			crc = _crc_ibutton_update(crc, usart_frame[i]);
+		}
+
+		if (crc == usart_frame[len]) {
+			handle_usart_frame(usart_frame[0], (uint8_t *) &usart_frame[1], len - 1);
+		} else {
+			uint8_t nak[2] = { usart_frame[0], USART_NAK_CRC };
+			usart_frame_error_count++;
+			usart_send_frame(USART_FRAME_NAK, nak, sizeof(nak));
+		}
+		CLR_REG1_FLAG(usart_reg1_flags, UART_FRAME_RECEIVED);
+	}
+
 	/**
 	 * --------> USART Command received.
 	 */
@@ -123,6 +361,11 @@ void parse_usart_cmd() {
 		memcpy(sub_usart_cmd_buffer, (uint8_t*) usart_cmd_buffer, usart_cmd_buffer_count);
 		sub_usart_cmd_buffer[usart_cmd_buffer_count] = 0;
 
+		// Trailing blanks would end up in the arguments
+		for (uint8_t i = usart_cmd_buffer_count; (i > 0) && (sub_usart_cmd_buffer[i - 1] == ' '); i--) {
+			sub_usart_cmd_buffer[i - 1] = 0;
+		}
+
 		char* pch;
 		pch = strtok((char *) sub_usart_cmd_buffer, " ");
 
@@ -133,11 +376,36 @@ void parse_usart_cmd() {
 			cmd = pch;
 		}
 
-		pch = strtok(NULL, " ");
-		if (pch != NULL) {
+		// Everything after the command, commands with several arguments split it themselves
+		pch = strtok(NULL, "");
+		while ((pch != NULL) && (*pch == ' ')) {
+			pch++;
+		}
+		if ((pch != NULL) && (*pch != 0)) {
 			cmd_args = pch;
 		}
 
 		handle_usart_cmd(cmd, cmd_args);
 	}
 }
+
+/**
+ * Sends a binary frame, raw (no newline translation).
+ */
+void usart_send_frame(uint8_t type, const uint8_t *body, uint8_t len) {
+	uint8_t crc = _crc_ibutton_update(0, len + 1);
+	crc = _crc_ibutton_update(crc, type);
+
+	usart_putchar(USART_SYNC);
+	usart_putchar(len + 1);
+	usart_putchar(type);
+	for (uint8_t i = 0; i < len; i++) {
+		crc = _crc_ibutton_update(crc, body[i]);
+		usart_putchar(body[i]);
+	}
+	usart_putchar(crc);
+}
+
+uint16_t usart_frame_errors() {
+	return usart_frame_error_count;
+}
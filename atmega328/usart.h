@@ -12,18 +12,76 @@ Includes
 /********************************************************************************
 Macros and Defines
 ********************************************************************************/
+/*
+ * Console baud rates, UBRR and U2X worked out from F_CPU at compile time:
+ * per rate the divider (16, or 8 with U2X) giving the smaller error is
+ * picked. Rates off by more than USART_BAUD_TOLERANCE are listed but
+ * refused by usart_configure(), e.g. 57600 and 115200 at 4 MHz.
+ */
+#define USART_BAUD_RATES(X) X(9600) X(19200) X(38400) X(57600) X(115200) X(125000) X(250000) X(500000)
+#define USART_BAUD_TOLERANCE 20 // per mille, receiver is fine up to ~2 % per side
+
+#define USART_DIVIDER(u2x)       ((u2x) ? 8UL : 16UL)
+#define USART_UBRR_N(baud, u2x)  (((F_CPU) + USART_DIVIDER(u2x) * (baud) / 2) / (USART_DIVIDER(u2x) * (baud))) // UBRR + 1, rounded
+#define USART_UBRR_DIV(baud, u2x) (USART_UBRR_N(baud, u2x) ? USART_UBRR_N(baud, u2x) : 1)
+#define USART_ACTUAL(baud, u2x)  ((F_CPU) / (USART_DIVIDER(u2x) * USART_UBRR_DIV(baud, u2x)))
+#define USART_ERROR(baud, u2x)   ((USART_ACTUAL(baud, u2x) > (baud) ? USART_ACTUAL(baud, u2x) - (baud) : (baud) - USART_ACTUAL(baud, u2x)) * 1000UL / (baud))
+#define USART_U2X(baud)          (USART_ERROR(baud, 1) < USART_ERROR(baud, 0))
+#define USART_UBRR(baud)         (USART_UBRR_DIV(baud, USART_U2X(baud)) - 1)
+
+// Frame format, the UCSR0C parity and stop bits (always 8 data bits)
+#define USART_FORMAT_8N1  0
+#define USART_FORMAT_8N2  (1<<USBS0)
+#define USART_FORMAT_8E1  (1<<UPM01)
+#define USART_FORMAT_8E2  ((1<<UPM01)|(1<<USBS0))
+#define USART_FORMAT_8O1  ((1<<UPM01)|(1<<UPM00))
+#define USART_FORMAT_8O2  ((1<<UPM01)|(1<<UPM00)|(1<<USBS0))
+#define USART_FORMAT_MASK ((1<<UPM01)|(1<<UPM00)|(1<<USBS0))
+
+// Boot setting, and the fallback when none is stored
 #define BAUD 9600
-#define MYUBRR F_CPU/16/BAUD-1
+#define USART_DEFAULT_FORMAT USART_FORMAT_8O2
 
 #define CONSOLE_PREFIX "\natmega328>"
 
 #define UART_CMD_RECEIVED  0
 #define UNSUPPORTED_CMD_RECEIVED  1
+#define UART_FRAME_RECEIVED  2
+
+/*
+ * Binary frames, told apart from console text by the sync byte (never typed):
+ *
+ *   USART_SYNC  len  type  body[len - 1]  crc8
+ *
+ * len counts type and body, crc8 (Dallas/iButton) covers len, type and body.
+ * Replies carry the request type | USART_FRAME_REPLY.
+ */
+#define USART_SYNC        0xA5
+#define USART_FRAME_MAX   64   // type + body
+#define USART_FRAME_REPLY 0x80
+#define USART_FRAME_NAK   0x7F // body: request type, USART_NAK_*
+
+// A frame with no byte for this long is dropped and the line is text again
+// (a host killed mid-write). Timer 1 ticks, 1024 cicles each, ~10 ms.
+#define USART_FRAME_TIMEOUT_TICKS ((uint16_t) (F_CPU / 1024 / 100))
+
+#define USART_NAK_CRC     1
+#define USART_NAK_LENGTH  2
+#define USART_NAK_UNKNOWN 3
+#define USART_NAK_ARGS    4
 
 /********************************************************************************
 Function Prototypes
 ********************************************************************************/
 void usart_init();
+bool usart_configure(uint32_t baud, uint8_t format);
+uint32_t usart_get_baud();
+uint8_t usart_get_format();
+void usart_drain();
+uint8_t usart_baud_count();
+uint32_t usart_baud_rate(uint8_t index, uint8_t *error, bool *u2x);
+int16_t usart_parse_format(const char *name);
+void usart_format_name(uint8_t format, char *name);
 char usart_getchar( void );
 void usart_putchar( char data );
 void usart_pstr (char *s);
@@ -33,5 +91,8 @@ int usart_putchar_printf(char var, FILE *stream);
 void handle_usart_interrupt();
 void usart_check_loop();
 void handle_usart_cmd(char *cmd, char *arg);
+void handle_usart_frame(uint8_t type, uint8_t *body, uint8_t len);
+void usart_send_frame(uint8_t type, const uint8_t *body, uint8_t len);
+uint16_t usart_frame_errors();
 
 #endif /* USART_H_ */
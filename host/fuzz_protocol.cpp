@@ -0,0 +1,87 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/protocol.h"
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Fuzz target for decodeRfFrame.
+ *
+ * The first input byte is the width R_RX_PL_WID reported, the rest is what
+ * was clocked out of the FIFO. Widths up to RF_PAYLOAD_MAX get a heap buffer
+ * of exactly the bytes present, so ASan catches any read past the frame;
+ * wider (garbage) widths must be rejected without touching the buffer.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size) {
+	if (size < 1) {
+		return 0;
+	}
+
+	uint8_t width = input[0];
+	const uint8_t *payload = input + 1;
+	size_t available = size - 1;
+	RfCommand cmd;
+
+	if (width > RF_PAYLOAD_MAX) {
+		uint8_t fifo[RF_PAYLOAD_MAX];
+		memset(fifo, 0, sizeof(fifo));
+		memcpy(fifo, payload, (available < sizeof(fifo)) ? available : sizeof(fifo));
+		if (decodeRfFrame(fifo, width, &cmd)) {
+			abort();
+		}
+		return 0;
+	}
+
+	if (available < width) {
+		return 0;
+	}
+
+	uint8_t *frame = (uint8_t *) malloc(width ? width : 1);
+	memcpy(frame, payload, width);
+	bool ok = decodeRfFrame(frame, width, &cmd);
+	free(frame);
+
+	// A decoded frame is a known command with the sequence byte only when flagged
+	if (ok && ((cmd.type == RF_CMD_NONE) || (cmd.type >= RF_CMD_COUNT))) {
+		abort();
+	}
+	if (!cmd.hasSeq && cmd.seq) {
+		abort();
+	}
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+/**
+ * Driver without libFuzzer (g++, afl-g++): runs every file given, or stdin
+ * when there is none, e.g. afl-fuzz -i corpus -o findings ./fuzz_protocol @@
+ */
+static int runInput(FILE *in) {
+	static uint8_t buf[4096];
+	size_t size = fread(buf, 1, sizeof(buf), in);
+	return LLVMFuzzerTestOneInput(buf, size);
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		return runInput(stdin);
+	}
+
+	for (int i = 1; i < argc; i++) {
+		FILE *in = fopen(argv[i], "rb");
+		if (!in) {
+			perror(argv[i]);
+			return 1;
+		}
+		runInput(in);
+		fclose(in);
+	}
+	return 0;
+}
+#endif
@@ -8,11 +8,19 @@
  version 2 as published by the Free Software Foundation.
  */
 
+#include <stddef.h>
+
 #include "nRF24L01.h"
 #include "RF24.h"
 
 HardwarePlatform HP;
 
+// Power Down -> Standby-I, crystal oscillator start-up (datasheet Tpd2stby)
+#define RF24_TPD2STBY_US 1500
+
+// Minimum CE high pulse to start a transmission (datasheet Thce)
+#define RF24_THCE_US 10
+
 /****************************************************************************/
 
 uint8_t RF24::read_register(uint8_t reg, uint8_t* buf, uint8_t len)
@@ -225,8 +233,19 @@ RF24::RF24():
   ack_payload_available(false),
   dynamic_payloads_enabled(false),
   ack_payload_length(0),
-  pipe0_reading_address(0)
+  pipe0_reading_address(0),
+  dynamic_payload_pipes(0),
+  state(RF24_POWER_DOWN),
+  config_reg(0),
+  retry_delay(B0101),
+  retry_count(B1111),
+  adaptive_retries(false),
+  min_retry_delay(0),
+  max_retry_delay(B1111),
+  min_retry_count(0),
+  max_retry_count(B1111)
 {
+  resetTxStats();
 }
 
 /****************************************************************************/
@@ -297,6 +316,18 @@ static const char * const rf24_pa_dbm_e_str_P[] = {
   rf24_pa_dbm_e_str_2,
   rf24_pa_dbm_e_str_3,
 };
+static const char rf24_state_e_str_0[] = "POWER_DOWN";
+static const char rf24_state_e_str_1[] = "STANDBY_I";
+static const char rf24_state_e_str_2[] = "STANDBY_II";
+static const char rf24_state_e_str_3[] = "RX";
+static const char rf24_state_e_str_4[] = "TX";
+static const char * const rf24_state_e_str_P[] = {
+  rf24_state_e_str_0,
+  rf24_state_e_str_1,
+  rf24_state_e_str_2,
+  rf24_state_e_str_3,
+  rf24_state_e_str_4,
+};
 
 void RF24::printDetails(void)
 {
@@ -318,6 +349,7 @@ void RF24::printDetails(void)
   printf_P(PSTR("Model\t\t = "PRIPSTR"\r\n"), rf24_model_e_str_P[isPVariant()]);
   printf_P(PSTR("CRC Length\t = "PRIPSTR"\r\n"), rf24_crclength_e_str_P[getCRCLength()]);
   printf_P(PSTR("PA Power\t = "PRIPSTR"\r\n"), rf24_pa_dbm_e_str_P[getPALevel()]);
+  printf_P(PSTR("State\t\t = "PRIPSTR"\r\n"), rf24_state_e_str_P[state]);
 }
 
 /****************************************************************************/
@@ -341,10 +373,14 @@ void RF24::begin(void)
   // WARNING: Delay is based on P-variant whereby non-P *may* require different timing.
   HP.delayMilliseconds( 5 ) ;
 
+  // Pick up where a previous run (e.g. before a MCU reset) left the chip
+  config_reg = read_register(CONFIG);
+  state = ( config_reg & _BV(PWR_UP) ) ? RF24_STANDBY_I : RF24_POWER_DOWN;
+
   // Set 1500uS (minimum for 32B payload in ESB@250KBPS) timeouts, to make testing a little easier
   // WARNING: If this is ever lowered, either 250KBS mode with AA is broken or maximum packet
   // sizes must never be used. See documentation for a more complete explanation.
-  write_register(SETUP_RETR,(B0101 << ARD) | (B1111 << ARC));
+  setRetries(B0101, B1111);
 
   // Restore our default PA level
   setPALevel( RF24_PA_MAX ) ;
@@ -353,20 +389,19 @@ void RF24::begin(void)
   // reset our data rate back to default value. This works
   // because a non-P variant won't allow the data rate to
   // be set to 250Kbps.
+  // On a non-P variant the failed attempt leaves the chip at 1Mbps, the
+  // slowest speed it supports, so there is no need to set it again.
   if( setDataRate( RF24_250KBPS ) )
   {
     p_variant = true ;
   }
-  
-  // Then set the data rate to the slowest (and most reliable) speed supported by all
-  // hardware.
-  setDataRate( RF24_250KBPS ) ;
 
   // Initialize CRC and request 2-byte (16bit) CRC
   setCRCLength( RF24_CRC_16 ) ;
   
   // Disable dynamic payloads, to match dynamic_payloads_enabled setting
   write_register(DYNPD,0);
+  dynamic_payload_pipes = 0;
 
   // Reset current status
   // Notice reset and flush is the last thing we do
@@ -384,9 +419,79 @@ void RF24::begin(void)
 
 /****************************************************************************/
 
+// Registers of rf24_image_t in programming order, FEATURE must precede DYNPD
+static const uint8_t image_registers[] =
+{
+  CONFIG, EN_AA, EN_RXADDR, SETUP_AW, SETUP_RETR, RF_CH, RF_SETUP, FEATURE, DYNPD
+};
+
+static_assert(offsetof(rf24_image_t, dynpd) == sizeof(image_registers) - 1, "rf24_image_t out of sync with image_registers");
+
+bool RF24::begin(const rf24_image_t& image)
+{
+  const uint8_t* values = &image.config;
+
+  HP.initIO();
+  HP.initSPI();
+
+  HP.ce(LOW);
+  HP.csn(HIGH);
+
+  // Keep the chip powered if it still is, it then needs no start-up delay
+  uint8_t power = read_register(CONFIG) & _BV(PWR_UP);
+
+  // FEATURE only accepts writes once activated on non-P parts
+  if ( ! image.p_variant && image.feature && ! read_register(FEATURE) )
+    toggle_features();
+
+  for ( uint8_t i = 0; i < sizeof(image_registers); i++ )
+    write_register(image_registers[i], i == 0 ? ( values[i] | power ) : values[i]);
+
+  for ( uint8_t i = 0; i < sizeof(image_registers); i++ )
+  {
+    uint8_t expected = i == 0 ? ( values[i] | power ) : values[i];
+    if ( read_register(image_registers[i]) != expected )
+      return false;
+  }
+
+  write_register(STATUS,_BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT) );
+  flush_rx();
+  flush_tx();
+
+  // Bring the driver shadows in line with the chip
+  p_variant = image.p_variant;
+  payload_size = image.payload_size;
+  config_reg = image.config | power;
+  state = power ? RF24_STANDBY_I : RF24_POWER_DOWN;
+  retry_delay = ( image.setup_retr >> ARD ) & B1111;
+  retry_count = ( image.setup_retr >> ARC ) & B1111;
+  wide_band = ( image.rf_setup & ( _BV(RF_DR_LOW) | _BV(RF_DR_HIGH) ) ) == _BV(RF_DR_HIGH);
+  dynamic_payload_pipes = image.dynpd;
+  dynamic_payloads_enabled = false;
+
+  return true;
+}
+
+/****************************************************************************/
+
+void RF24::captureImage(rf24_image_t& image)
+{
+  uint8_t* values = &image.config;
+
+  for ( uint8_t i = 0; i < sizeof(image_registers); i++ )
+    values[i] = read_register(image_registers[i]);
+
+  image.config &= ~( _BV(PWR_UP) | _BV(PRIM_RX) );
+  image.payload_size = payload_size;
+  image.p_variant = p_variant;
+}
+
+/****************************************************************************/
+
 void RF24::startListening(void)
 {
-  write_register(CONFIG, read_register(CONFIG) | _BV(PWR_UP) | _BV(PRIM_RX));
+  powerUp();
+  write_config(config_reg | _BV(PRIM_RX));
   write_register(STATUS, _BV(RX_DR) | _BV(TX_DS) | _BV(MAX_RT) );
 
   // Restore the pipe0 adddress, if exists
@@ -397,11 +502,10 @@ void RF24::startListening(void)
   flush_rx();
   flush_tx();
 
-  // Go!
+  // Go! The chip needs 130us to settle into RX, but that is no reason to
+  // keep the CPU waiting: nothing can be received before anyway.
   HP.ce(HIGH);
-
-  // wait for the radio to come up (130us actually only needed)
-  HP.delayMicroseconds(130);
+  state = RF24_RX;
 }
 
 /****************************************************************************/
@@ -411,21 +515,59 @@ void RF24::stopListening(void)
   HP.ce(LOW);
   flush_tx();
   flush_rx();
+
+  if ( state != RF24_POWER_DOWN )
+    state = RF24_STANDBY_I;
 }
 
 /****************************************************************************/
 
 void RF24::powerDown(void)
 {
-  write_register(CONFIG,read_register(CONFIG) & ~_BV(PWR_UP));
+  HP.ce(LOW);
+  write_config(config_reg & ~_BV(PWR_UP));
+  state = RF24_POWER_DOWN;
 }
 
 /****************************************************************************/
 
 void RF24::powerUp(void)
 {
-  write_register(CONFIG,read_register(CONFIG) | _BV(PWR_UP));
-  HP.delayMicroseconds(150);
+  // Only the way out of Power Down costs time, Standby/RX/TX are already up
+  if ( state != RF24_POWER_DOWN )
+    return;
+
+  write_config(config_reg | _BV(PWR_UP));
+  HP.delayMicroseconds(RF24_TPD2STBY_US);
+  state = RF24_STANDBY_I;
+}
+
+/****************************************************************************/
+
+void RF24::standby(void)
+{
+  HP.ce(LOW);
+
+  if ( state != RF24_POWER_DOWN )
+    state = RF24_STANDBY_I;
+}
+
+/****************************************************************************/
+
+rf24_state_e RF24::getState(void)
+{
+  return state;
+}
+
+/****************************************************************************/
+
+void RF24::write_config(uint8_t value)
+{
+  if ( value != config_reg )
+  {
+    write_register(CONFIG, value);
+    config_reg = value;
+  }
 }
 
 /******************************************************************/
@@ -445,19 +587,34 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
   // or MAX_RT (maximum retries, transmission failed).  Also, we'll timeout in case the radio
   // is flaky and we get neither.
 
-  // IN the end, the send should be blocking.  It comes back in 60ms worst case.
+  // IN the end, the send should be blocking.  It comes back in ~85ms worst case (250kbps, ARD and ARC 15).
   // Generally much faster.
   uint8_t observe_tx;
   uint8_t status;
-  uint8_t retry_count = 0;
+  uint16_t polls = getMaxTimeout() / 100 + 10;
 
-  // Monitor the send
-  do
+  // Monitor the send, giving up a little after the retransmits must have ended
+  while (true)
   {
     status = read_register(OBSERVE_TX,&observe_tx,1);
     IF_SERIAL_DEBUG(printf_P(PSTR("observe_tx = %02x\r\n"),observe_tx));
+
+    if ( status & ( _BV(TX_DS) | _BV(MAX_RT) ) )
+      break;
+
+    if ( ! polls-- )
+    {
+      // Neither flag within the bound: the chip is flaky, not the link. Keep
+      // it out of the statistics (it would raise ARD/ARC and with them the
+      // bound) and drop the payload. The state stays RF24_TX, the chip may
+      // still be transmitting.
+      IF_SERIAL_DEBUG(printf_P(PSTR("...Timeout.\r\n")));
+      flush_tx();
+      return false;
+    }
+
+    HP.delayMicroseconds(100);
   }
-  while( ! ( status & ( _BV(TX_DS) | _BV(MAX_RT) ) ) && ( retry_count++ < 5 ) );
 
   // The part above is what you could recreate with your own interrupt handler,
   // and then call this when you got an interrupt
@@ -474,6 +631,15 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
   result = tx_ok;
   IF_SERIAL_DEBUG(printf_P(PSTR(result?"...OK.\r\n":"...Failed\r\n")));
 
+  recordTxResult(tx_ok);
+
+  // A payload that hit MAX_RT stays in the TX FIFO, drop it
+  if ( tx_fail )
+    flush_tx();
+
+  // CE is already low, the chip is back in Standby-I
+  state = RF24_STANDBY_I;
+
   // Handle the ack packet
   if ( ack_payload_available )
   {
@@ -487,10 +653,11 @@ bool RF24::write( const void* buf, uint8_t len, const bool multicast )
 
 void RF24::startWrite( const void* buf, uint8_t len, const bool multicast )
 {
-  // Transmitter power-up
-  write_register(CONFIG, ( read_register(CONFIG) | _BV(PWR_UP) ) & ~_BV(PRIM_RX) );
-  HP.delayMicroseconds(150);
-
+  // Leave RX, then power up (waits only when coming out of Power Down).
+  // Standby-I -> TX settling (130us) is handled by the chip after the CE pulse.
+  HP.ce(LOW);
+  powerUp();
+  write_config(config_reg & ~_BV(PRIM_RX));
 
   // Send the payload - Unicast (W_TX_PAYLOAD) or multicast (W_TX_PAYLOAD_NO_ACK)
   write_payload( buf, len,
@@ -498,9 +665,10 @@ void RF24::startWrite( const void* buf, uint8_t len, const bool multicast )
 
   // Allons!
   HP.ce(HIGH);
-  HP.delayMicroseconds(10);
+  HP.delayMicroseconds(RF24_THCE_US);
 
   HP.ce(LOW);
+  state = RF24_TX;
 }
 
 /****************************************************************************/
@@ -571,6 +739,41 @@ bool RF24::read( void* buf, uint8_t len )
 
 /****************************************************************************/
 
+bool RF24::readPayload( void* buf, rf24_payload_info_t& info )
+{
+  const uint8_t max_payload_size = 32;
+  uint8_t* current = reinterpret_cast<uint8_t*>(buf);
+
+  // RX_P_NO reads 0b111 when the RX FIFO is empty (0b110 is unused)
+  uint8_t pipe = ( get_status() >> RX_P_NO ) & B111;
+  if ( pipe > 5 )
+    return false;
+
+  uint8_t data_len = payload_size;
+  if ( dynamic_payload_pipes & _BV(pipe) )
+  {
+    data_len = getDynamicPayloadSize();
+    if ( data_len > max_payload_size )
+    {
+      flush_rx();
+      return false;
+    }
+  }
+
+  info.length = data_len;
+  info.pipe = pipe;
+
+  HP.csn(LOW);
+  HP.spiTransfer( R_RX_PAYLOAD );
+  while ( data_len-- )
+    *current++ = HP.spiTransfer(0xff);
+  HP.csn(HIGH);
+
+  return true;
+}
+
+/****************************************************************************/
+
 void RF24::whatHappened(bool& tx_ok,bool& tx_fail,bool& rx_ready)
 {
   // Read the status & reset the status in one easy call
@@ -581,6 +784,10 @@ void RF24::whatHappened(bool& tx_ok,bool& tx_fail,bool& rx_ready)
   tx_ok = status & _BV(TX_DS);
   tx_fail = status & _BV(MAX_RT);
   rx_ready = status & _BV(RX_DR);
+
+  // A finished transmission leaves the chip in Standby-I (CE is low)
+  if ( state == RF24_TX && ( tx_ok || tx_fail ) )
+    state = RF24_STANDBY_I;
 }
 
 /****************************************************************************/
@@ -693,6 +900,31 @@ void RF24::enableDynamicPayloads(void)
   write_register(DYNPD,read_register(DYNPD) | _BV(DPL_P5) | _BV(DPL_P4) | _BV(DPL_P3) | _BV(DPL_P2) | _BV(DPL_P1) | _BV(DPL_P0));
 
   dynamic_payloads_enabled = true;
+  dynamic_payload_pipes = B111111;
+}
+
+/****************************************************************************/
+
+void RF24::enableDynamicPayloads(uint8_t pipe)
+{
+  if ( pipe > 5 )
+    return;
+
+  write_register(FEATURE,read_register(FEATURE) | _BV(EN_DPL) );
+
+  // If it didn't work, the features are not enabled
+  if ( ! read_register(FEATURE) )
+  {
+    // So enable them and try again
+    toggle_features();
+    write_register(FEATURE,read_register(FEATURE) | _BV(EN_DPL) );
+  }
+
+  // DPL needs auto acknowledgement on the pipe
+  write_register(EN_AA,read_register(EN_AA) | _BV(pipe));
+  write_register(DYNPD,read_register(DYNPD) | _BV(pipe));
+
+  dynamic_payload_pipes |= _BV(pipe);
 }
 
 /****************************************************************************/
@@ -720,6 +952,28 @@ void RF24::enableAckPayload(void)
   //
 
   write_register(DYNPD,read_register(DYNPD) | _BV(DPL_P1) | _BV(DPL_P0));
+  dynamic_payload_pipes |= _BV(DPL_P1) | _BV(DPL_P0);
+}
+
+/****************************************************************************/
+
+void RF24::enableAckPayload(uint8_t pipe)
+{
+  if ( pipe > 5 )
+    return;
+
+  write_register(FEATURE,read_register(FEATURE) | _BV(EN_DYN_ACK) | _BV(EN_ACK_PAY) | _BV(EN_DPL) );
+
+  // If it didn't work, the features are not enabled
+  if ( ! read_register(FEATURE) )
+  {
+    // So enable them and try again
+    toggle_features();
+    write_register(FEATURE,read_register(FEATURE) | _BV(EN_DYN_ACK) | _BV(EN_ACK_PAY) | _BV(EN_DPL) );
+  }
+
+  // ACK payloads need dynamic payloads on the pipe, the others keep theirs
+  enableDynamicPayloads(pipe);
 }
 
 /****************************************************************************/
@@ -799,6 +1053,22 @@ bool RF24::testRPD(void)
 
 /****************************************************************************/
 
+bool RF24::sampleChannel(uint8_t channel)
+{
+  write_register(RF_CH, channel);
+
+  HP.ce(HIGH);
+  HP.delayMicroseconds(170);
+
+  // RPD is only valid while in RX mode, read it before dropping CE
+  bool result = p_variant ? testRPD() : testCarrier();
+  HP.ce(LOW);
+
+  return result;
+}
+
+/****************************************************************************/
+
 void RF24::setPALevel(rf24_pa_dbm_e level)
 {
   uint8_t setup = read_register(RF_SETUP) ;
@@ -936,7 +1206,7 @@ rf24_datarate_e RF24::getDataRate( void )
 
 void RF24::setCRCLength(rf24_crclength_e length)
 {
-  uint8_t config = read_register(CONFIG) & ~( _BV(CRCO) | _BV(EN_CRC)) ;
+  uint8_t config = config_reg & ~( _BV(CRCO) | _BV(EN_CRC)) ;
   
   // switch uses RAM (evil!)
   if ( length == RF24_CRC_DISABLED )
@@ -952,7 +1222,7 @@ void RF24::setCRCLength(rf24_crclength_e length)
     config |= _BV(EN_CRC);
     config |= _BV( CRCO );
   }
-  write_register( CONFIG, config ) ;
+  write_config( config ) ;
 }
 
 /****************************************************************************/
@@ -960,7 +1230,7 @@ void RF24::setCRCLength(rf24_crclength_e length)
 rf24_crclength_e RF24::getCRCLength(void)
 {
   rf24_crclength_e result = RF24_CRC_DISABLED;
-  uint8_t config = read_register(CONFIG) & ( _BV(CRCO) | _BV(EN_CRC)) ;
+  uint8_t config = config_reg & ( _BV(CRCO) | _BV(EN_CRC)) ;
 
   if ( config & _BV(EN_CRC ) )
   {
@@ -977,15 +1247,105 @@ rf24_crclength_e RF24::getCRCLength(void)
 
 void RF24::disableCRC( void )
 {
-  uint8_t disable = read_register(CONFIG) & ~_BV(EN_CRC) ;
-  write_register( CONFIG, disable ) ;
+  uint8_t disable = config_reg & ~_BV(EN_CRC) ;
+  write_config( disable ) ;
 }
 
 /****************************************************************************/
 
 void RF24::setRetries(uint8_t delay, uint8_t count)
 {
- write_register(SETUP_RETR,(delay&0xf)<<ARD | (count&0xf)<<ARC);
+ retry_delay = delay & 0xf;
+ retry_count = count & 0xf;
+ write_register(SETUP_RETR,retry_delay<<ARD | retry_count<<ARC);
+}
+
+/****************************************************************************/
+
+void RF24::setAdaptiveRetries(bool enable, uint8_t min_delay, uint8_t max_delay, uint8_t min_count, uint8_t max_count)
+{
+  adaptive_retries = enable;
+  min_retry_delay = MIN(min_delay,B1111);
+  max_retry_delay = MIN(MAX(max_delay,min_retry_delay),B1111);
+  min_retry_count = MIN(min_count,B1111);
+  max_retry_count = MIN(MAX(max_count,min_retry_count),B1111);
+
+  if ( enable )
+  {
+    uint8_t delay = MIN(MAX(retry_delay,min_retry_delay),max_retry_delay);
+    uint8_t count = MIN(MAX(retry_count,min_retry_count),max_retry_count);
+    setRetries(delay, count);
+  }
+}
+
+/****************************************************************************/
+
+void RF24::recordTxResult(bool tx_ok)
+{
+  uint8_t observe_tx = read_register(OBSERVE_TX);
+  uint8_t arc_cnt = (observe_tx >> ARC_CNT) & B1111;
+
+  tx_stats.packets++;
+  tx_stats.retries += arc_cnt;
+  tx_stats.lost = (observe_tx >> PLOS_CNT) & B1111;
+  if ( ! tx_ok )
+    tx_stats.failed++;
+
+  // Moving average over ~8 packets, a failed packet counts as the whole retry budget
+  int16_t sample = ( tx_ok ? arc_cnt : B1111 ) * 16;
+  tx_stats.retries_avg += ( sample - tx_stats.retries_avg ) / 8;
+
+  adapt_retries(tx_ok);
+}
+
+/****************************************************************************/
+
+void RF24::adapt_retries(bool tx_ok)
+{
+  if ( ! adaptive_retries )
+    return;
+
+  uint8_t delay = retry_delay;
+  uint8_t count = retry_count;
+
+  if ( ! tx_ok )
+  {
+    count = MIN(count + 1, max_retry_count);
+    delay = MIN(delay + 1, max_retry_delay);
+  }
+  else if ( ( tx_stats.packets & 0xf ) == 0 )
+  {
+    // ~3x the mean retries keeps the residual loss small at the observed rate
+    uint8_t target = 2 + ( 3 * tx_stats.retries_avg ) / 16;
+    count = MIN(MAX(target,min_retry_count),max_retry_count);
+
+    // Fewer than one retry per packet: the delay only adds latency
+    if ( tx_stats.retries_avg < 16 )
+      delay = MAX(delay,min_retry_delay + 1) - 1;
+    else
+      delay = MIN(delay + 1, max_retry_delay);
+  }
+
+  if ( delay != retry_delay || count != retry_count )
+    setRetries(delay, count);
+}
+
+/****************************************************************************/
+
+void RF24::getTxStats(rf24_tx_stats_t& stats)
+{
+  stats = tx_stats;
+}
+
+/****************************************************************************/
+
+void RF24::resetTxStats(void)
+{
+  tx_stats.packets = 0;
+  tx_stats.failed = 0;
+  tx_stats.retries = 0;
+  tx_stats.lost = 0;
+  tx_stats.retries_avg = 0;
 }
 
 /****************************************************************************/
@@ -997,10 +1357,29 @@ uint8_t RF24::getRetries( void )
 
 /****************************************************************************/
 
-uint16_t RF24::getMaxTimeout( void )
+uint32_t RF24::getMaxTimeout( void )
 {
-  uint8_t retries = getRetries() ;
-  uint16_t to = ((250 + (250 * ((retries & 0xf0) >> 4))) * (retries & 0x0f)) ;
+  // Longest packet: preamble, 5 byte address, 9 bit PCF, 32 byte payload, 2 byte CRC
+  const uint16_t max_packet_bits = 8 * ( 1 + 5 + 32 + 2 ) + 9;
+  const uint16_t settle_us = 130;
+
+  uint16_t air_us;
+  switch ( getDataRate() )
+  {
+    case RF24_250KBPS:
+      air_us = max_packet_bits * 4;
+      break;
+    case RF24_2MBPS:
+      air_us = max_packet_bits / 2 + 1;
+      break;
+    default:
+      air_us = max_packet_bits;
+      break;
+  }
+
+  // ARC retransmits wait ARD each, and all ARC + 1 attempts settle and go on air
+  uint32_t to = (uint32_t) ( 250 + ( 250 * retry_delay ) ) * retry_count
+              + (uint32_t) ( settle_us + air_us ) * ( retry_count + 1 );
 
   return to ;
 }
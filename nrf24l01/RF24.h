@@ -48,6 +48,56 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * Operating state of the chip, as tracked by the driver.
+ *
+ * Standby-II (CE high with an empty TX FIFO) is never entered by this
+ * driver, CE is always dropped after a transmit pulse.
+ */
+typedef enum { RF24_POWER_DOWN = 0, RF24_STANDBY_I, RF24_STANDBY_II, RF24_RX, RF24_TX } rf24_state_e;
+
+/**
+ * Register image of a configured chip.
+ *
+ * Captured by captureImage() and replayed by begin(const rf24_image_t&).
+ * Pipe addresses are not part of it, open the pipes as usual afterwards.
+ */
+typedef struct
+{
+  uint8_t config;      /**< CONFIG without PWR_UP/PRIM_RX */
+  uint8_t en_aa;
+  uint8_t en_rxaddr;
+  uint8_t setup_aw;
+  uint8_t setup_retr;
+  uint8_t rf_ch;
+  uint8_t rf_setup;
+  uint8_t feature;
+  uint8_t dynpd;
+  uint8_t payload_size; /**< Static payload size of the driver */
+  bool p_variant;       /**< Result of the nRF24L01+ probe */
+} rf24_image_t;
+
+/**
+ * Received payload descriptor.
+ *
+ * Filled in by readPayload()
+ */
+typedef struct { uint8_t length; uint8_t pipe; } rf24_payload_info_t;
+
+/**
+ * Transmit statistics collected from OBSERVE_TX.
+ *
+ * Filled in by getTxStats()
+ */
+typedef struct
+{
+  uint16_t packets;    /**< Transmissions recorded */
+  uint16_t failed;     /**< Transmissions which hit MAX_RT */
+  uint32_t retries;    /**< Sum of ARC_CNT over all transmissions */
+  uint8_t lost;        /**< PLOS_CNT, lost packets since the last channel change (saturates at 15) */
+  uint8_t retries_avg; /**< Moving average of retries per packet, in 1/16 */
+} rf24_tx_stats_t;
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -62,6 +112,15 @@ private:
   bool dynamic_payloads_enabled; /**< Whether dynamic payloads are enabled. */ 
   uint8_t ack_payload_length; /**< Dynamic size of pending ack payload. */
   uint64_t pipe0_reading_address; /**< Last address set on pipe 0 for reading. */
+  uint8_t dynamic_payload_pipes; /**< Bit mask of pipes with dynamic payloads enabled. */
+  rf24_state_e state; /**< Current operating state of the chip. */
+  uint8_t config_reg; /**< Shadow of the CONFIG register. */
+  rf24_tx_stats_t tx_stats; /**< Outcome of the transmissions so far. */
+  uint8_t retry_delay; /**< ARD currently programmed. */
+  uint8_t retry_count; /**< ARC currently programmed. */
+  bool adaptive_retries; /**< Whether ARD/ARC follow the observed retries. */
+  uint8_t min_retry_delay, max_retry_delay; /**< Bounds for adaptive ARD. */
+  uint8_t min_retry_count, max_retry_count; /**< Bounds for adaptive ARC. */
 
 protected:
 
@@ -182,6 +241,25 @@ protected:
    * are enabled.  See the datasheet for details.
    */
   void toggle_features(void);
+
+  /**
+   * Write CONFIG if @p value differs from the shadow copy
+   *
+   * @param value The new CONFIG value
+   */
+  void write_config(uint8_t value);
+
+  /**
+   * Retune ARD/ARC after a transmission
+   *
+   * A failed packet raises both count and delay by one notch.  Every 16
+   * packets the count is retargeted to 2 + 3x the average retries, and the
+   * delay is shortened while retries stay below one per packet, lengthened
+   * otherwise.  Everything stays inside the bounds of setAdaptiveRetries().
+   *
+   * @param tx_ok Whether the packet was acknowledged
+   */
+  void adapt_retries(bool tx_ok);
   /**@}*/
 
 public:
@@ -206,6 +284,27 @@ public:
    */
   void begin(void);
 
+  /**
+   * Begin operation of the chip from a register image
+   *
+   * Skips the P-variant probe, the settling delay and the read-modify-write
+   * setup of begin(void): every register of @p image is written in one
+   * ordered run, then read back once to verify.  Intended for images saved
+   * by captureImage() on the same hardware, e.g. after a watchdog reset.
+   *
+   * @param image Registers to program
+   * @return True if the readback matched, false if the chip needs a full
+   * begin(void) (e.g. it was just powered on and has not settled yet)
+   */
+  bool begin(const rf24_image_t& image);
+
+  /**
+   * Capture the current configuration as a register image
+   *
+   * @param[out] image Where to store the registers
+   */
+  void captureImage(rf24_image_t& image);
+
   /**
    * Start listening on the pipes opened for reading.
    *
@@ -352,6 +451,45 @@ public:
    */
   uint8_t getRetries( void ) ;
 
+  /**
+   * Let ARD/ARC follow the retries observed in OBSERVE_TX
+   *
+   * Minimises the expected latency at the current loss rate: short delays
+   * while the link is clean, more and longer retries as packets get lost.
+   * The delay lower bound must still cover the ACK (payload) air time at
+   * the data rate in use.
+   *
+   * @param enable Whether to adapt, setRetries() values are kept when off
+   * @param min_delay Lowest ARD, 0-15
+   * @param max_delay Highest ARD, 0-15
+   * @param min_count Lowest ARC, 0-15
+   * @param max_count Highest ARC, 0-15
+   */
+  void setAdaptiveRetries(bool enable, uint8_t min_delay = 1, uint8_t max_delay = 15, uint8_t min_count = 3, uint8_t max_count = 15);
+
+  /**
+   * Record the outcome of a transmission
+   *
+   * Reads OBSERVE_TX into the statistics and adapts the retries if enabled.
+   * write() calls this itself, call it after whatHappened() when using
+   * startWrite() with interrupts.
+   *
+   * @param tx_ok Whether the packet was acknowledged
+   */
+  void recordTxResult(bool tx_ok);
+
+  /**
+   * Get the transmit statistics
+   *
+   * @param[out] stats Copy of the statistics collected so far
+   */
+  void getTxStats(rf24_tx_stats_t& stats);
+
+  /**
+   * Clear the transmit statistics
+   */
+  void resetTxStats(void);
+
   /**
    * Set RF communication channel
    *
@@ -411,6 +549,17 @@ public:
    */
   void enableAckPayload(void);
 
+  /**
+   * Enable custom payloads on the acknowledge packets of a single pipe
+   *
+   * Like enableAckPayload(), but only @p pipe is switched to dynamic
+   * payloads, the other pipes keep the static payload size and so stay
+   * reachable by transmitters without dynamic payloads.
+   *
+   * @param pipe Which pipe# (0-5) gets ACK payloads
+   */
+  void enableAckPayload(uint8_t pipe);
+
   /**
    * Enable dynamically-sized payloads
    *
@@ -421,6 +570,17 @@ public:
    */
   void enableDynamicPayloads(void);
 
+  /**
+   * Enable dynamically-sized payloads on a single pipe
+   *
+   * Turns on the EN_DPL feature and sets the DYNPD bit of @p pipe only,
+   * leaving the other pipes on the static payload size.  The transmitter
+   * talking to this pipe must use dynamic payloads as well.
+   *
+   * @param pipe Which pipe# (0-5) to switch to dynamic payloads
+   */
+  void enableDynamicPayloads(uint8_t pipe);
+
   /**
    * Determine whether the hardware is an nRF24L01+ or not.
    *
@@ -540,6 +700,21 @@ public:
    */
   void powerUp(void) ;
 
+  /**
+   * Drop to Standby-I, keeping the oscillator running
+   *
+   * Stops listening without powering down, so the next startListening()
+   * or startWrite() needs no power-up delay.
+   */
+  void standby(void);
+
+  /**
+   * Operating state the driver has put the chip into
+   *
+   * @return One of rf24_state_e
+   */
+  rf24_state_e getState(void);
+
   /**
    * Test whether there are bytes available to be read
    *
@@ -551,6 +726,22 @@ public:
    */
   bool available(uint8_t* pipe_num);
 
+  /**
+   * Fetch the next payload from the RX FIFO together with its size and pipe
+   *
+   * The pipe number is taken from STATUS.  For pipes with dynamic payloads
+   * the width comes from R_RX_PL_WID, which is validated: a width above 32
+   * bytes means a corrupted packet and the RX FIFO is flushed, as the
+   * datasheet requires.  Exactly @p info.length bytes are clocked out, no
+   * padding reads are done; an empty payload is popped with a length of 0.
+   *
+   * @param[out] buf Where to put the data, must hold 32 bytes
+   * @param[out] info Length and pipe of the payload read
+   * @return True if a valid payload was read, false if the FIFO was empty
+   * or the payload was discarded
+   */
+  bool readPayload(void* buf, rf24_payload_info_t& info);
+
   /**
    * Non-blocking write to the open writing pipe
    *
@@ -647,14 +838,32 @@ public:
    */
   bool testRPD(void) ;
 
+  /**
+   * Sample a single channel for a signal
+   *
+   * Tunes to @p channel, enables the receiver for the shortest time the
+   * detector needs (130us RX settling plus 40us RPD integration) and reads
+   * RPD, or CD on non-P hardware.  Meant for channel sweeps: call
+   * stopListening() first, and restore the channel and startListening()
+   * afterwards.
+   *
+   * @param channel Which RF channel to sample (0-125)
+   * @return true if a signal was detected
+   */
+  bool sampleChannel(uint8_t channel);
+
 
   /**
    * Calculate the maximum timeout in us based on current hardware
    * configuration.
    *
+   * Covers the retransmit delays and the settling and air time of every
+   * attempt, for the longest packet at the current data rate.  Above 65 ms
+   * at 250kbps with the retries at their maximum.
+   *
    * @return us of maximum timeout; accounting for retries
    */
-  uint16_t getMaxTimeout(void) ;
+  uint32_t getMaxTimeout(void) ;
 
   /**@}*/
 };
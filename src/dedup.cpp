@@ -0,0 +1,96 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <util/atomic.h>
+
+#include "dedup.h"
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	bool valid;
+	uint8_t lastSeq; // newest sequence number accepted
+	uint8_t window;  // bit n set: lastSeq - n was accepted
+	uint16_t dropped;
+} DedupState;
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static DedupState dedupState[DEDUP_PIPES];
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Sliding window replay check, O(1) per frame.
+ *
+ * Frames newer than the last one move the window forward. Frames within
+ * DEDUP_WINDOW behind it are accepted once. Anything older is taken as a
+ * controller restart and resynchronizes the window instead of being dropped.
+ */
+bool isDuplicateFrame(uint8_t pipe, uint8_t seq) {
+	if (pipe >= DEDUP_PIPES) {
+		return false;
+	}
+
+	DedupState *state = &dedupState[pipe];
+
+	uint8_t ahead = seq - state->lastSeq;
+
+	if (!state->valid || ((ahead >= 128) && ((uint8_t) -ahead >= DEDUP_WINDOW))) {
+		state->valid = true;
+		state->lastSeq = seq;
+		state->window = 1;
+		return false;
+	}
+
+	if (ahead == 0) {
+		state->dropped++;
+		return true;
+	}
+
+	if (ahead < 128) {
+		state->window = (ahead >= DEDUP_WINDOW) ? 1 : (uint8_t) ((state->window << ahead) | 1);
+		state->lastSeq = seq;
+		return false;
+	}
+
+	uint8_t mask = 1 << (uint8_t) -ahead;
+	if (state->window & mask) {
+		state->dropped++;
+		return true;
+	}
+
+	state->window |= mask;
+	return false;
+}
+
+/**
+ * Forgets the sequence numbers of a pipe, the next one is taken as new.
+ */
+void resetDedupWindow(uint8_t pipe) {
+	if (pipe < DEDUP_PIPES) {
+		dedupState[pipe].valid = false;
+	}
+}
+
+// The counters are updated by the radio interrupt
+uint16_t getDuplicateCount(uint8_t pipe) {
+	uint16_t count = 0;
+	if (pipe < DEDUP_PIPES) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			count = dedupState[pipe].dropped;
+		}
+	}
+	return count;
+}
+
+void resetDuplicateCounts() {
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		for (uint8_t i = 0; i < DEDUP_PIPES; i++) {
+			dedupState[i].dropped = 0;
+		}
+	}
+}
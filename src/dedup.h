@@ -0,0 +1,30 @@
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define DEDUP_PIPES  6
+#define DEDUP_WINDOW 8 // sequence numbers remembered behind the newest one
+
+/*
+ * A controller that restarts its sequence numbers within DEDUP_WINDOW behind
+ * the last one would have its first frames dropped. Controllers send one
+ * frame without a sequence number after a restart (a query will do), which
+ * resets the window of its pipe.
+ */
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+bool isDuplicateFrame(uint8_t pipe, uint8_t seq);
+void resetDedupWindow(uint8_t pipe);
+uint16_t getDuplicateCount(uint8_t pipe);
+void resetDuplicateCounts();
+
+#endif /* DEDUP_H_ */
@@ -0,0 +1,340 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/crc16.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gateway.h"
+#include "../common/util.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+// 256 bytes, the uint8_t indices wrap by themselves
+#define GW_QUEUE_SIZE 256
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint8_t pipe;
+	uint8_t len;
+	uint32_t timestamp;
+	uint8_t data[32];
+} RadioSlot;
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static uint8_t txQueue[GW_QUEUE_SIZE];
+static volatile uint8_t txHead = 0; // written by the main loop only
+static volatile uint8_t txTail = 0; // written by the UDRE interrupt
+
+// Radio frames copied by the radio interrupt, SLIP encoded by pumpGateway()
+static RadioSlot radioSlots[GW_RADIO_SLOTS];
+static volatile uint8_t radioHead = 0; // radio interrupt
+static volatile uint8_t radioTail = 0; // main loop
+
+static uint8_t rxBuffer[GW_HOST_MAX];
+static uint8_t rxCount = 0;
+static uint8_t rxCrc = 0; // over all bytes but the last one received, that one may be the crc
+static bool rxEscape = false;
+static bool rxOverflow = false;
+
+static GatewayHostFrame hostFrame;
+static volatile bool hostReady = false;
+
+static GatewayStats stats;
+
+static FILE logStream;
+static char logLine[GW_LOG_MAX];
+static uint8_t logCount = 0;
+
+/********************************************************************************
+	TX Queue
+********************************************************************************/
+static uint8_t queueFill() {
+	return (uint8_t) (txHead - txTail);
+}
+
+static void queueByte(uint8_t data) {
+	txQueue[txHead] = data;
+	txHead = (uint8_t) (txHead + 1);
+}
+
+static void queueEscaped(uint8_t data) {
+	if (data == SLIP_END) {
+		queueByte(SLIP_ESC);
+		queueByte(SLIP_ESC_END);
+	} else if (data == SLIP_ESC) {
+		queueByte(SLIP_ESC);
+		queueByte(SLIP_ESC_ESC);
+	} else {
+		queueByte(data);
+	}
+}
+
+static bool queueFits(uint8_t headLen, uint8_t bodyLen) {
+	// Worst case, every byte escaped
+	uint16_t worstCase = 2 * ((uint16_t) headLen + bodyLen + 1) + 2;
+	return worstCase <= (uint16_t) (GW_QUEUE_SIZE - 1 - queueFill());
+}
+
+// The radio interrupt counts too
+static void countDropped() {
+	uint8_t sreg = SREG;
+	cli();
+	stats.dropped++;
+	SREG = sreg;
+}
+
+/**
+ * Queues one frame made of a header and a body, main loop only, with
+ * interrupts enabled: the UDRE interrupt may start on the first bytes while
+ * the rest is encoded. Frames never go out partially, false if it does not
+ * fit. Nobody waits for the UART.
+ */
+static bool queueFrame(const uint8_t *head, uint8_t headLen, const uint8_t *body, uint8_t bodyLen) {
+	if (!queueFits(headLen, bodyLen)) {
+		return false;
+	}
+
+	uint8_t crc = 0;
+	queueByte(SLIP_END);
+	for (uint8_t i = 0; i < headLen; i++) {
+		crc = _crc_ibutton_update(crc, head[i]);
+		queueEscaped(head[i]);
+	}
+	for (uint8_t i = 0; i < bodyLen; i++) {
+		crc = _crc_ibutton_update(crc, body[i]);
+		queueEscaped(body[i]);
+	}
+	queueEscaped(crc);
+	queueByte(SLIP_END);
+
+	if (queueFill() > stats.queuePeak) {
+		stats.queuePeak = queueFill();
+	}
+
+	_on(UDRIE0, UCSR0B);
+	return true;
+}
+
+/********************************************************************************
+	Console Text
+********************************************************************************/
+static void flushLog() {
+	if (logCount > 0) {
+		uint8_t type = GW_FRAME_LOG;
+		if (!queueFrame(&type, 1, (const uint8_t *) logLine, logCount)) {
+			countDropped();
+		}
+		logCount = 0;
+	}
+}
+
+/**
+ * stdout in gateway mode: printf output goes out as GW_FRAME_LOG frames,
+ * one per line, so it cannot break the framing.
+ */
+static int logPutchar(char c, FILE *stream) {
+	if ((c == '\n') || (c == '\r')) {
+		flushLog();
+		return 0;
+	}
+
+	logLine[logCount++] = c;
+	if (logCount == GW_LOG_MAX) {
+		flushLog();
+	}
+	return 0;
+}
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Takes over USART0 from the console: double speed, 8N1, RX and UDRE
+ * interrupts.
+ */
+void initGateway() {
+	UBRR0H = (uint8_t) (GATEWAY_UBRR >> 8);
+	UBRR0L = (uint8_t) GATEWAY_UBRR;
+	UCSR0A = (1<<U2X0);
+	UCSR0B = (1<<RXEN0)|(1<<TXEN0)|(1<<RXCIE0);
+	UCSR0C = (1<<UCSZ01)|(1<<UCSZ00);
+
+	fdev_setup_stream(&logStream, logPutchar, NULL, _FDEV_SETUP_WRITE);
+	stdout = &logStream;
+}
+
+/**
+ * USART data register empty interrupt, sends the next queued byte.
+ */
+void handleGatewayTx() {
+	if (txTail == txHead) {
+		_off(UDRIE0, UCSR0B);
+		return;
+	}
+
+	UDR0 = txQueue[txTail];
+	txTail = (uint8_t) (txTail + 1);
+}
+
+/**
+ * USART receive interrupt, undoes the SLIP framing of host frames. A frame
+ * is handed to the main loop if its crc matches, one frame at a time. The
+ * crc is kept up per byte, END only compares it (a byte every 40 us).
+ */
+void handleGatewayRx() {
+	bool frameError = UCSR0A & ((1<<FE0)|(1<<DOR0));
+	uint8_t data = UDR0;
+
+	if (frameError) {
+		rxOverflow = true; // spoil the frame in progress
+	}
+
+	if (data == SLIP_END) {
+		if (rxCount == 0) {
+			rxCrc = 0;
+			rxEscape = false;
+			rxOverflow = false;
+			return; // leading END or idle line
+		}
+
+		if (rxOverflow || rxEscape || (rxCount < 2) || (rxCrc != rxBuffer[rxCount - 1])) {
+			stats.hostErrors++;
+		} else if (hostReady) {
+			stats.hostDropped++;
+		} else {
+			hostFrame.type = rxBuffer[0];
+			hostFrame.len = rxCount - 2;
+			memcpy(hostFrame.body, &rxBuffer[1], hostFrame.len);
+			hostReady = true;
+			stats.hostFrames++;
+		}
+
+		rxCount = 0;
+		rxCrc = 0;
+		rxEscape = false;
+		rxOverflow = false;
+		return;
+	}
+
+	if (rxEscape) {
+		rxEscape = false;
+		if (data == SLIP_ESC_END) {
+			data = SLIP_END;
+		} else if (data == SLIP_ESC_ESC) {
+			data = SLIP_ESC;
+		} else {
+			rxOverflow = true;
+		}
+	} else if (data == SLIP_ESC) {
+		rxEscape = true;
+		return;
+	}
+
+	if (rxCount < GW_HOST_MAX) {
+		if (rxCount > 0) {
+			rxCrc = _crc_ibutton_update(rxCrc, rxBuffer[rxCount - 1]);
+		}
+		rxBuffer[rxCount++] = data;
+	} else {
+		rxOverflow = true;
+	}
+}
+
+/**
+ * Hands a received radio frame to pumpGateway(), from the radio interrupt.
+ * Only a copy, the encoding is left to the main loop. False if all
+ * GW_RADIO_SLOTS are taken (counted in dropped).
+ */
+bool forwardRadioFrame(uint8_t pipe, const uint8_t *data, uint8_t len, uint32_t timestamp) {
+	if ((uint8_t) (radioHead - radioTail) == GW_RADIO_SLOTS) {
+		countDropped();
+		return false;
+	}
+
+	RadioSlot *slot = &radioSlots[radioHead & (GW_RADIO_SLOTS - 1)];
+	slot->pipe = pipe;
+	slot->len = (len > sizeof(slot->data)) ? sizeof(slot->data) : len;
+	slot->timestamp = timestamp;
+	memcpy(slot->data, data, slot->len);
+
+	radioHead = (uint8_t) (radioHead + 1);
+	return true;
+}
+
+/**
+ * Main loop side of forwardRadioFrame(): SLIP encodes the waiting radio
+ * frames into the TX queue while there is room, the rest waits for the next
+ * call.
+ */
+void pumpGateway() {
+	while (radioTail != radioHead) {
+		const RadioSlot *slot = &radioSlots[radioTail & (GW_RADIO_SLOTS - 1)];
+		uint8_t head[6] = {
+			GW_FRAME_RX, slot->pipe,
+			(uint8_t) slot->timestamp, (uint8_t) (slot->timestamp >> 8),
+			(uint8_t) (slot->timestamp >> 16), (uint8_t) (slot->timestamp >> 24)
+		};
+
+		if (!queueFrame(head, sizeof(head), slot->data, slot->len)) {
+			return;
+		}
+		radioTail = (uint8_t) (radioTail + 1);
+		stats.forwarded++;
+	}
+}
+
+/**
+ * Takes the pending host frame, false if there is none.
+ */
+bool readHostFrame(GatewayHostFrame *frame) {
+	if (!hostReady) {
+		return false;
+	}
+
+	memcpy(frame, &hostFrame, sizeof(GatewayHostFrame));
+	hostReady = false;
+	return true;
+}
+
+void sendGatewayTxStatus(bool delivered) {
+	uint8_t frame[2] = { GW_FRAME_TX_STATUS, delivered };
+
+	if (delivered) {
+		stats.txOk++;
+	} else {
+		stats.txFailed++;
+	}
+	if (!queueFrame(frame, sizeof(frame), NULL, 0)) {
+		countDropped();
+	}
+}
+
+void sendGatewayStats() {
+	uint8_t type = GW_FRAME_STATS;
+	GatewayStats snapshot;
+
+	uint8_t sreg = SREG;
+	cli();
+	memcpy(&snapshot, &stats, sizeof(GatewayStats));
+	SREG = sreg;
+
+	// AVR is little endian, the struct goes out as is
+	if (!queueFrame(&type, 1, (const uint8_t *) &snapshot, sizeof(GatewayStats))) {
+		countDropped();
+	}
+}
+
+void resetGatewayStats() {
+	uint8_t sreg = SREG;
+	cli();
+	memset(&stats, 0, sizeof(GatewayStats));
+	SREG = sreg;
+}
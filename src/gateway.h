@@ -0,0 +1,88 @@
+#ifndef GATEWAY_H_
+#define GATEWAY_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+/*
+ * Gateway UART: U2X, 8N1. At 4 Mhz UBRR 1 is 250 kbaud (UBRR 0, 500 kbaud, is
+ * exact as well but leaves 80 cicles per byte, less than the radio interrupt
+ * keeps the RX interrupt waiting).
+ *
+ * Budget at 250 kbaud (not measured on the board, worked out from the frame
+ * sizes): a byte every 40 us (160 cicles). The UDRE interrupt takes ~40 of
+ * them while the queue drains, ~25 % of the CPU. An RX frame is 17 bytes on
+ * the wire with an 8 byte payload (~1400 frames/s) and 41 with 32 bytes
+ * (~600 frames/s), escapes not counted. Beyond that frames wait in
+ * GW_RADIO_SLOTS and are dropped, GW_FRAME_STATS (dropped, queuePeak) tells
+ * whether a link keeps up.
+ */
+#define GATEWAY_UBRR 1
+
+/*
+ * SLIP (RFC 1055) framed, every frame is
+ *
+ *   END  type  body...  crc8  END
+ *
+ * crc8 (Dallas/iButton, as the EEPROM settings) covers type and body.
+ */
+#define SLIP_END     0xC0
+#define SLIP_ESC     0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+// Receiver -> host
+#define GW_FRAME_RX        0x01 // uint8_t pipe, uint32_t timestamp (Timer 1 cicles, LE), payload
+#define GW_FRAME_TX_STATUS 0x02 // uint8_t delivered
+#define GW_FRAME_STATS     0x03 // GatewayStats, uint16_t LE each
+#define GW_FRAME_LOG       0x04 // console text
+
+// Host -> receiver
+#define GW_HOST_TX          0x10 // 5 byte address (LE), payload 1..32
+#define GW_HOST_STATS       0x11 // no body, answered with GW_FRAME_STATS
+#define GW_HOST_RESET_STATS 0x12
+
+#define GW_ADDRESS_LEN   5
+#define GW_HOST_MAX      (1 + GW_ADDRESS_LEN + 32 + 1) // decoded, with the crc
+#define GW_LOG_MAX       32
+#define GW_RADIO_SLOTS   4    // radio frames waiting for the main loop, power of two
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint16_t forwarded;  // radio frames sent to the host
+	uint16_t dropped;    // frames for the host that found no free radio slot or TX queue room
+	uint16_t queuePeak;  // highest TX queue fill, bytes
+	uint16_t hostFrames; // valid frames from the host
+	uint16_t hostDropped;// host frames arriving before the previous one was handled
+	uint16_t hostErrors; // bad crc, escape or length
+	uint16_t txOk;       // host frames delivered over RF
+	uint16_t txFailed;
+} GatewayStats;
+
+typedef struct {
+	uint8_t type;
+	uint8_t len;         // body bytes
+	uint8_t body[GW_HOST_MAX];
+} GatewayHostFrame;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void initGateway();
+void pumpGateway();
+void handleGatewayRx();
+void handleGatewayTx();
+bool forwardRadioFrame(uint8_t pipe, const uint8_t *data, uint8_t len, uint32_t timestamp);
+bool readHostFrame(GatewayHostFrame *frame);
+void sendGatewayTxStatus(bool delivered);
+void sendGatewayStats();
+void resetGatewayStats();
+
+#endif /* GATEWAY_H_ */
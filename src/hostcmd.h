@@ -0,0 +1,26 @@
+#ifndef HOSTCMD_H_
+#define HOSTCMD_H_
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+/*
+ * Host control frames on the console UART, framing in usart.h. Multi byte
+ * values are little endian. Every request is answered with type | 0x80, or
+ * with a NAK (USART_FRAME_NAK: request type, USART_NAK_*).
+ *
+ * Zone state reply (HOST_GET_VOLUME, HOST_SET_VOLUME, HOST_RF_COMMAND):
+ *   zone, volume, muted, int8 balance, int8 trim left, int8 trim right, state version
+ */
+#define HOST_GET_VOLUME  0x01 // uint8_t zone
+#define HOST_SET_VOLUME  0x02 // uint8_t zone, uint8_t volume
+#define HOST_RF_COMMAND  0x03 // an RF frame (protocol.h), run as if received; zone from RF_OP_ZONE, else the console zone
+#define HOST_GET_STATS   0x04 // reply: see encodeHostStats()
+#define HOST_GET_CONFIG  0x05 // reply: channel, profile, zones, taper steps, volume sink, pot driver, IR protocol + 1 (0 none), RF protocol version
+#define HOST_GET_TRACE   0x06 // uint8_t skip (optional); reply: total, TraceEntry[] oldest first from skip, at most HOST_TRACE_ENTRIES
+
+#define HOST_ZONE_REPLY_LEN 7
+#define HOST_REPLY_MAX      80
+#define HOST_TRACE_ENTRIES  10 // per reply, 6 bytes each (uint32_t time, event, arg)
+
+#endif /* HOSTCMD_H_ */
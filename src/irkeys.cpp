@@ -0,0 +1,53 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/pgmspace.h>
+
+#include "irkeys.h"
+
+/********************************************************************************
+	Key Table
+********************************************************************************/
+typedef struct {
+	uint8_t protocol; // IR_PROTOCOL_*
+	uint16_t address;
+	uint8_t command;
+	uint8_t type;     // RfCommandType
+	uint8_t arg;
+} IrKey;
+
+// Volume is attenuation: a negative step is louder
+static const IrKey irKeys[] PROGMEM = {
+	// protocol          address  code     command             arg
+	{ IR_PROTOCOL_NEC,   0x00,    0x15,    RF_CMD_VOLUME_STEP, (uint8_t) -1 },    // "Car MP3" remote VOL+
+	{ IR_PROTOCOL_NEC,   0x00,    0x07,    RF_CMD_VOLUME_STEP, 1 },               // VOL-
+	{ IR_PROTOCOL_NEC,   0x00,    0x09,    RF_CMD_MUTE,        RF_MUTE_TOGGLE },  // EQ
+	{ IR_PROTOCOL_RC5,   0x00,    16,      RF_CMD_VOLUME_STEP, (uint8_t) -1 },    // TV volume +
+	{ IR_PROTOCOL_RC5,   0x00,    17,      RF_CMD_VOLUME_STEP, 1 },               // TV volume -
+	{ IR_PROTOCOL_RC5,   0x00,    13,      RF_CMD_MUTE,        RF_MUTE_TOGGLE },  // TV mute
+};
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Looks the key up, false if it has no function. The command addresses
+ * IR_ZONE, there is no pipe to take the zone from.
+ */
+bool mapIRKey(const IrCode *code, RfCommand *cmd) {
+	for (uint8_t i = 0; i < sizeof(irKeys) / sizeof(irKeys[0]); i++) {
+		if ((pgm_read_byte(&irKeys[i].protocol) == code->protocol)
+				&& (pgm_read_word(&irKeys[i].address) == code->address)
+				&& (pgm_read_byte(&irKeys[i].command) == code->command)) {
+			cmd->type = pgm_read_byte(&irKeys[i].type);
+			cmd->arg = pgm_read_byte(&irKeys[i].arg);
+			cmd->arg2 = 0;
+			cmd->hasSeq = false;
+			cmd->seq = 0;
+			cmd->hasZone = true;
+			cmd->zone = IR_ZONE;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,21 @@
+#ifndef IRKEYS_H_
+#define IRKEYS_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "protocol.h"
+#include "../atmega328/irrecv.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define IR_ZONE 0 // zone driven by the handheld remote
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+bool mapIRKey(const IrCode *code, RfCommand *cmd);
+
+#endif /* IRKEYS_H_ */
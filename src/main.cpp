@@ -10,11 +10,30 @@
 #include <util/delay.h>
 #include <stdlib.h>
 #include <avr/eeprom.h>
+#include <avr/wdt.h>
 
 #include "../nrf24l01/RF24.h"
 #include "../common/util.h"
 #include "../nrf24l01/atmega328.h"
 #include "../atmega328/mtimer.h"
+#include "../atmega328/meminfo.h"
+#include "../atmega328/supply.h"
+#include "../atmega328/potspi.h"
+#include "../atmega328/irrecv.h"
+#include "protocol.h"
+#include "dedup.h"
+#include "pipes.h"
+#include "scanner.h"
+#include "radioprofile.h"
+#include "settings.h"
+#include "warmstate.h"
+#include "pt2257.h"
+#include "volumesink.h"
+#include "zones.h"
+#include "irkeys.h"
+#include "gateway.h"
+#include "trace.h"
+#include "hostcmd.h"
 
 extern "C" {
 #include "../atmega328/usart.h"
@@ -24,85 +43,234 @@ extern "C" {
 	Macros and Defines
 ********************************************************************************/
 #define DEBUG_ARRAY_SIZE 1
-#define SKIP_REPEATED_IR 3
+#define SKIP_REPEATED_IR 3 // repeat frames of a held key ignored before it auto-repeats
 
-#define VP0 0
-#define VP1 1
+// Handheld remote on ICP1 (PB0), protocol selected in irrecv.h. Hardware change: PB0 drives
+// the status LED on existing boards, LED1 has to be rewired to PB1 (LED_PIN PB1) first.
+#define IR_RECEIVER 0
 
-#define VC0 4
-#define VC1 5
+// Status LED
+#define LED_PIN PB0
 
-#define PT2257_ADDR  0b10001000
-#define START 		 0x08
-#define MT_SLA_ACK	 0x18   //slave ACK has been received
-#define MT_DATA_ACK	 0x28   //master ACK has been received
-#define VOLUME_MAX   79
+#if IR_RECEIVER && (LED_PIN == PB0)
+#error "PB0 is the IR receiver input (ICP1), move the LED"
+#endif
+
+// Sniffer/bridge: every received frame goes to a host over SLIP framed UART (see gateway.h),
+// host frames are sent over RF. Replaces the text console.
+#define GATEWAY_MODE 0
+
+#define VOLUME_MAX   SINK_LEVEL_MAX
+
+// Volume output stage, see volumesink.h
+#define VOLUME_SINK_PT2257 0
+#define VOLUME_SINK_POT    1
+#define VOLUME_SINK_BOTH   2 // PT2257 and pot driven together
+#define VOLUME_SINK_NULL   3
+#define VOLUME_SINK VOLUME_SINK_PT2257
 
 // #define CONTROLLER_CHANNEL 116 // Controller 1 (PC)
 #define CONTROLLER_CHANNEL 124 // Controller 2 (Bathroom)
 
+// Amplifier protection after power-up: hold a low volume for a while
+#define BOOT_VOLUME          (VOLUME_MAX - 9) // 70 dB on the linear taper
+#define BOOT_PROTECT_SECONDS 10
+
+// No TWI/SPI access before the nRF24L01 power-on reset (Tpor, 100 ms) and the PT2257 are through
+#define BOOT_SETTLE_MS 100
+// The protective volume write is repeated at this period until the PT2257 takes it
+#define BOOT_RETRY_MS  10
+
+// RF commands during the protection window: queue them until it ends, or honour them right away (ends the window)
+#define BOOT_RF_QUEUE  0
+#define BOOT_RF_HONOUR 1
+#define BOOT_RF_POLICY BOOT_RF_QUEUE
+
+// A 'baud' switch not confirmed with 'baud ok' at the new rate within this time is undone
+#define BAUD_CONFIRM_SECONDS 10
+
+// Print the radio registers at boot, takes ~1.5 s of console time at 9600 baud
+#define PRINT_RADIO_DETAILS 0
+
+// Save the volume to EEPROM only when the supply starts to fail, instead of 2 s after every change.
+// The zone changed last is written by the ADC interrupt within ~7 ms of the fail (one conversion,
+// a write in progress and its own), the others by the next main loop pass, which console dumps
+// and 'scan' can delay past the hold-up time. Needs enough hold-up capacitance to keep AVcc up
+// for POWER_FAIL_ZONES EEPROM writes (~3.4 ms each). While the monitor is not calibrated or did
+// not trust the boot supply, the 2 s save is used.
+#define POWER_FAIL_SAVE 1
+#define POWER_FAIL_ZONES 2 // volume writes per power fail, the zone changed last goes first
+
+// Watchdog period, a stuck SPI wait resets the MCU and a warm restart follows (TWI waits time out)
+#define WATCHDOG_TIMEOUT WDTO_120MS
+
+// Sweep all channels at boot, 2: also move to the quietest allowed channel
+#define SCAN_ON_BOOT 0
+
+/********************************************************************************
+	Types
+********************************************************************************/
+#if VOLUME_SINK == VOLUME_SINK_POT
+typedef SpiPotSink VolumeSink;
+#elif VOLUME_SINK == VOLUME_SINK_BOTH
+typedef CompositeSink<PT2257Sink, SpiPotSink> VolumeSink;
+#elif VOLUME_SINK == VOLUME_SINK_NULL
+typedef NullSink VolumeSink;
+#else
+typedef PT2257Sink VolumeSink;
+#endif
+
+// One sink per zone, e.g. with ZONE_COUNT 3:
+// ZoneSinks<MuxedSink<PT2257Sink, 0>, MuxedSink<PT2257Sink, 1>, SpiPotSink>
+typedef ZoneSinks<VolumeSink> ZoneOutputs;
+
+static_assert(ZoneOutputs::count == ZONE_COUNT, "ZoneOutputs needs one sink per zone");
+
+#if GATEWAY_MODE && (POT_DRIVER == POT_DRIVER_MSPIM)
+#error "GATEWAY_MODE and POT_DRIVER_MSPIM both need USART0"
+#endif
+
 /********************************************************************************
 	Function Prototypes
 ********************************************************************************/
 void initGPIO();
-void send_spi(uint16_t data);
-void sendVolume();
-void initTWI();
-void initLowVolume();
+void sendBootVolume(uint64_t currentTimeCicles);
+void runBootSequencer(uint64_t currentTimeCicles);
+void startRadio(const WarmState *warm);
+void applyRfCommand(const RfCommand *cmd);
+void applyConsoleCommand(uint8_t type, uint8_t arg, uint8_t arg2);
+void applyLocalCommand(const RfCommand *cmd);
+void handleIRKeys();
+void runGateway();
+uint8_t encodeZoneState(uint8_t zone, uint8_t *data);
+uint8_t encodeHostStats(uint8_t *data);
+void sendZones(bool all);
+void refreshAckPayloads(uint8_t firstPipes);
+void openReadingPipes();
+void runChannelScan(bool autoSelect);
+void runTxTest(uint8_t count);
+void suspendRadio();
+void resumeRadio();
+void printRadioProfiles();
+void switchConsoleBaud(char *args);
+void confirmConsoleBaud();
+void revertConsoleBaud();
+void printConsoleBauds();
+bool initRadio();
+void storeRadioImage();
+void updateWarmState();
+void saveStateOnPowerFail();
+void savePowerFailZone();
+bool saveZoneIfChanged(uint8_t zone);
 
 /********************************************************************************
 	Global Variables
 ********************************************************************************/
 RF24 radio;
-const uint64_t pipes[2] = { 0xF0F0F0F0E1LL, 0xF0F0F0F0D2LL };
-volatile uint8_t volume = VOLUME_MAX;
-bool volChanged = false;
+const uint64_t writingPipe = 0xF0F0F0F0E1LL;
+uint8_t readingPipes = 0; // bit mask of open reading pipes
+uint8_t radioChannel = CONTROLLER_CHANNEL;
+uint8_t radioProfile = RADIO_PROFILE_LONG_RANGE;
+ZoneState zones[ZONE_COUNT];
+ZoneOutputs zoneSinks;
+bool volChanged = false; // any zone changed
 volatile uint64_t saveVolJob1Cicles = 0;
+uint8_t consoleZone = 0; // zone of the console commands
+volatile uint8_t lastChangedZone = 0;
+uint8_t irRepeats = 0;   // repeat frames of the key held down
+ConsoleConfig consoleFallback; // last confirmed line setting while a switch is pending
+uint64_t baudRevertCicles = 0;
+
+typedef enum {
+	BOOT_SETTLE = 0, // power-on reset of the radio and the PT2257, no bus access
+	BOOT_MUTE,        // protective volume not taken by the PT2257 yet, retried
+	BOOT_PROTECT,     // low volume on the amplifier, RF commands handled by BOOT_RF_POLICY
+	BOOT_RUN
+} BootState;
+
+BootState bootState = BOOT_SETTLE;
+uint64_t bootTimeCicles = 0; // end of the current boot state, next retry in BOOT_MUTE
+bool radioReady = false;     // configured and listening, see startRadio()
+volatile uint8_t stateVersion = 0;
 
 /********************************************************************************
 	Interrupt Service
 ********************************************************************************/
 ISR(USART_RX_vect)
 {
+#if GATEWAY_MODE
+	handleGatewayRx();
+#else
 	handle_usart_interrupt();
+#endif
 }
 
+#if GATEWAY_MODE
+ISR(USART_UDRE_vect)
+{
+	handleGatewayTx();
+}
+#endif
+
 ISR(INT0_vect)
 {
+#if GATEWAY_MODE
+    // SPI reads of up to three payloads take longer than the two byte times the USART
+    // buffers, let its interrupts in (INT0 itself stays masked, it does not nest)
+    _off(INT0, EIMSK);
+    sei();
+#endif
+
     bool tx_ok, tx_fail, rx_ok;
     radio.whatHappened(tx_ok, tx_fail, rx_ok);
 
     if (rx_ok) {
-        uint8_t data[50];
-        uint8_t len = radio.getDynamicPayloadSize();
-        radio.read(data, len);
-
-        //printf("\nRX %d", data[0]);
-
-        if ((len > 3) && (data[0] == 110) && (data[1] == 120) && (data[2] == 130)) {
-
-    		if (data[3] == 100) {
-    			if (volume > 1) {
-    				volume -= 2;
-    			}
-    		} else if (data[3] == 101) {
-    			if (volume < VOLUME_MAX) {
-    				volume += 2;
-    			}
-    		} else if (data[3] == 102) {
-    			volume = data[4];
-    		}
-
-    		if (volume > VOLUME_MAX) {
-    			volume = VOLUME_MAX;
-    		}
-
-    		volChanged = true;
-
+        uint8_t data[RF_PAYLOAD_MAX];
+        rf24_payload_info_t rx;
+
+        uint8_t rxPipes = 0;
+
+        // Drain the RX FIFO, invalid widths are flushed by readPayload()
+        while (radio.readPayload(data, rx)) {
+        	//printf("\nRX %d", data[0]);
+
+        	rxPipes |= _BV(rx.pipe);
+
+#if GATEWAY_MODE
+        	forwardRadioFrame(rx.pipe, data, rx.length, (uint32_t) getCurrentTimeCicles());
+#endif
+
+        	RfCommand cmd;
+        	if (!decodeRfFrame(data, rx.length, &cmd)) {
+        		continue;
+        	}
+
+        	// Retransmitted frame whose ACK got lost, it was applied already.
+        	// A frame without a sequence number marks a controller restart.
+        	if (!cmd.hasSeq) {
+        		resetDedupWindow(rx.pipe);
+        	} else if (isDuplicateFrame(rx.pipe, cmd.seq)) {
+        		traceEvent(TRACE_DUPLICATE, rx.pipe);
+        		continue;
+        	}
+
+        	// Permissions, rate limit and arbitration between controllers
+        	if (!admitPipeCommand(rx.pipe, &cmd)) {
+        		traceEvent(TRACE_DENIED, rx.pipe);
+        		continue;
+        	}
+
+        	applyRfCommand(&cmd);
         }
 
-        radio.flush_rx();
+        // The ACK payload was consumed by this transaction and the state may have changed
+        refreshAckPayloads(rxPipes);
     }
+
+#if GATEWAY_MODE
+    cli();
+    _on(INT0, EIMSK);
+#endif
 }
 
 ISR(TIMER1_OVF_vect)
@@ -110,72 +278,163 @@ ISR(TIMER1_OVF_vect)
 	incrementOvf();
 }
 
+ISR(ADC_vect)
+{
+	// Not left to the main loop, a console dump or 'scan' can hold it for seconds
+	if (handleSupplyInterrupt()) {
+		savePowerFailZone();
+	}
+}
+
+ISR(TIMER1_CAPT_vect)
+{
+	handleIRCapture();
+}
+
 /********************************************************************************
 	Main
 ********************************************************************************/
 int main(void) {
 
-    // initialize usart module
+    // initialize usart module (taken over by the pot when POT_DRIVER_MSPIM)
+#if GATEWAY_MODE
+	initGateway();
+#else
 	usart_init();
 
+	ConsoleConfig console;
+	if (loadConsoleConfig(&console)) {
+		// Rejected (nothing changed) if the table no longer has that rate
+		usart_configure(console.baud, console.format);
+	}
+#endif
+
     // Init GPIO
     initGPIO();
 
-    initTWI();
+    // A watchdog reset may have cut a transfer short, a slave can still hold SDA low
+    if (getResetFlags() & _BV(WDRF)) {
+    	clearTWIBus();
+    }
+    initPT2257();
 
     initTimer();
 
+    // Armed before the first bus access (disabled by captureResetFlags()), so an SPI
+    // wait that hangs during boot, warm restart included, resets the MCU as well
+    wdt_enable(WATCHDOG_TIMEOUT);
+
+#if IR_RECEIVER
+    initIR();
+#endif
+
     // enable interrupts
     sei();
 
-    _delay_ms(2000);
-
 	// Console friendly output
     printf(CONSOLE_PREFIX);
 
-    // Set low volume for 10 seconds
-    initLowVolume();
-
-    radio.begin();
-    radio.setRetries(15, 15);
-    radio.setPayloadSize(8);
-    radio.setPALevel(RF24_PA_MAX);
-	radio.setChannel(CONTROLLER_CHANNEL);
-
-    radio.openWritingPipe(pipes[0]);
-    radio.openReadingPipe(1, pipes[1]);
+    traceEvent(TRACE_BOOT, getResetFlags());
 
-    radio.startListening();
+    for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+    	loadChannelOffsets(zone, &zones[zone].offsets);
+    }
 
-    radio.printDetails();
+    WarmState warm;
+    bool warmStart = loadWarmState(&warm);
 
-    // Read saved volume value from EEPROM
-    volume = eeprom_read_byte((uint8_t *) 0);
+    if (warmStart) {
+    	// Amplifier kept running through the reset, restore the level right away
+    	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+    		zones[zone].volume = warm.volume[zone];
+    		zones[zone].savedVolume = loadZoneVolume(zone);
+    		zones[zone].muted = warm.mutedZones & _BV(zone);
+    	}
+    	stateVersion = warm.stateVersion;
+    	radioChannel = warm.radioChannel;
+    	bootState = BOOT_RUN;
+
+    	// The chips stayed powered, no settling time needed. Radio first: should the
+    	// bus still fail, the TWI transfers time out and commands are received anyway.
+    	startRadio(&warm);
+    	sendZones(true);
+    } else {
+    	// The main loop waits BOOT_SETTLE_MS, then sends the low volume and brings up the radio
+    	bootState = BOOT_SETTLE;
+    	bootTimeCicles = getCurrentTimeCicles() + MS_TO_CICLES(BOOT_SETTLE_MS);
+
+    	// Read saved volume values from EEPROM, applied when the protection window ends
+    	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+    		uint8_t volume = loadZoneVolume(zone);
+    		zones[zone].savedVolume = volume;
+    		zones[zone].volume = (volume > VOLUME_MAX) ? VOLUME_MAX : volume;
+    	}
+    }
 
-    // set default volume
-    sendVolume();
+#if POWER_FAIL_SAVE
+    // Only now the volume is worth saving
+    initSupplyMonitor();
+#endif
 
 	// main loop
     while (1) {
+    	wdt_reset();
+
+    	// Flagged by the ADC interrupt after it saved the zone changed last, first in the pass
+    	// as the hold-up time is short
+    	if (takePowerFail()) {
+    		saveStateOnPowerFail();
+    	}
+
+#if GATEWAY_MODE
+    	runGateway();
+#else
     	// main usart loop for console
     	usart_check_loop();
+#endif
 
-    	if (volChanged) {
-    		sendVolume();
-    		volChanged = false;
-    		saveVolJob1Cicles = convertSecondsToCicles(2); // save volume each 2 seconds
-    		_on(PB0, PORTB);
-    	}
+#if IR_RECEIVER
+    	handleIRKeys();
+#endif
 
     	uint64_t currentTimeCicles = getCurrentTimeCicles();
 
+#if !GATEWAY_MODE
+    	if ((baudRevertCicles != 0) && (currentTimeCicles >= baudRevertCicles)) {
+    		revertConsoleBaud();
+    	}
+#endif
+
+    	if (bootState != BOOT_RUN) {
+    		runBootSequencer(currentTimeCicles);
+    	} else if (volChanged) {
+    		volChanged = false;
+    		sendZones(false);
+    		updateWarmState();
+    		saveVolJob1Cicles = convertSecondsToCicles(2); // save volume each 2 seconds (LED only while the supply is monitored)
+    		_on(LED_PIN, PORTB);
+    	}
+
     	/**
-    	 * --------> Job 1 (Save volume to EEPROM)
+    	 * --------> Job 1 (Save volume and balance/trim to EEPROM)
     	 */
     	if ((saveVolJob1Cicles != 0) && (currentTimeCicles >= saveVolJob1Cicles)) {
-    		_off(PB0, PORTB);
+    		_off(LED_PIN, PORTB);
     		saveVolJob1Cicles = 0;
-    		eeprom_write_byte((uint8_t *) 0, volume);
+
+    		// Offsets are saved either way, a sweep of balance steps ends up as one write
+    		for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+    			if (zones[zone].offsetsChanged) {
+    				zones[zone].offsetsChanged = false;
+    				saveChannelOffsets(zone, &zones[zone].offsets);
+    			}
+    		}
+    		// Nothing would save it at power-off
+    		if (!isSupplyMonitored()) {
+    			for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+    				saveZoneIfChanged(zone);
+    			}
+    		}
     	}
     }
 }
@@ -189,145 +448,1018 @@ void initGPIO() {
     // GPIO Interrupt INT0
     // The falling edge of INT0 generates an interrupt request.
     EICRA = (0<<ISC11)|(0<<ISC10)|(1<<ISC01)|(0<<ISC00);
-    // Enable INT0
-    EIMSK = (1<<INT0);
+    // INT0 is enabled by startRadio() once the nRF24L01 is configured
+
+    // Digital pot serial-out
+    initPot();
+
+    _out(LED_PIN, DDRB); // LED1
+    _off(LED_PIN, PORTB); // LED1 default 0
+}
+
+void handle_usart_cmd(char *cmd, char *args) {
+	if (strcmp(cmd, "test") == 0) {
+		printf("\n TEST [%s]", args);
+	}
+
+	if (strcmp(cmd, "send1") == 0) {
+		printf("\nsendZones");
+		sendZones(true);
+	}
+
+	if (strcmp(cmd, "send2") == 0) {
+		potWrite(POT_WORD(POT_SELECT_0 | POT_SELECT_1, atoi(args)));
+	}
+
+	if (strcmp(cmd, "potbench") == 0) {
+		PotBenchResult bench;
+		// 'potbench mspim' also times the USART driver, garbling the console meanwhile
+		benchPotDrivers(&bench, (args != NULL) && (strcmp(args, "mspim") == 0));
+		printf("\n cicles/write bitbang=%u hwspi=%u mspim=%u", bench.bitbang, bench.hwspi, bench.mspim);
+	}
+
+	if (strcmp(cmd, "dup") == 0) {
+		printf("\n duplicates dropped:");
+		for (uint8_t pipe = 0; pipe < DEDUP_PIPES; pipe++) {
+			printf(" p%d=%u", pipe, getDuplicateCount(pipe));
+		}
+
+		if ((args != NULL) && (strcmp(args, "reset") == 0)) {
+			resetDuplicateCounts();
+		}
+	}
+
+	if (strcmp(cmd, "pipes") == 0) {
+		for (uint8_t pipe = PIPE_FIRST_READ; pipe < PIPE_COUNT; pipe++) {
+			if (readingPipes & _BV(pipe)) {
+				PipeStats stats;
+				getPipeStats(pipe, &stats);
+				printf("\n p%d ok=%u denied=%u limited=%u arbitrated=%u dup=%u", pipe,
+						stats.accepted, stats.denied, stats.rateLimited, stats.arbitrated, getDuplicateCount(pipe));
+			}
+		}
+	}
+
+	if (strcmp(cmd, "scan") == 0) {
+		runChannelScan((args != NULL) && (strcmp(args, "auto") == 0));
+	}
+
+	if (strcmp(cmd, "details") == 0) {
+		printf("\n");
+		radio.printDetails();
+	}
+
+	if (strcmp(cmd, "txtest") == 0) {
+		runTxTest((args != NULL) ? atoi(args) : 10);
+	}
+
+	if (strcmp(cmd, "txstat") == 0) {
+		rf24_tx_stats_t stats;
+		radio.getTxStats(stats);
+		uint8_t retries = radio.getRetries();
+		printf("\n packets=%u failed=%u retries=%lu lost=%u", stats.packets, stats.failed, (unsigned long) stats.retries, stats.lost);
+		printf("\n avg=%u/16 ARD=%u ARC=%u", stats.retries_avg, retries >> ARD, retries & 0x0F);
+
+		if ((args != NULL) && (strcmp(args, "reset") == 0)) {
+			radio.resetTxStats();
+		}
+	}
 
-    _out(DDC0, DDRC); // SI
-    _out(DDC1, DDRC); // SCK
-    _out(DDC2, DDRC); // CSN
+	if (strcmp(cmd, "profile") == 0) {
+		if (args != NULL) {
+			uint8_t id = atoi(args);
+
+			suspendRadio();
+			if (applyRadioProfile(radio, id)) {
+				radioProfile = id;
+				eeprom_update_byte(EEPROM_RADIO_PROFILE, id);
+				storeRadioImage();
+				updateWarmState();
+			} else {
+				printf("\n profile %d not supported", id);
+				applyRadioProfile(radio, radioProfile);
+			}
+			resumeRadio();
+		}
+
+		printRadioProfiles();
+	}
 
-    _on(PC2, PORTC); // Default disable CSN
-    _off(PC1, PORTC); // SCK default 0
+	if (strcmp(cmd, "mute") == 0) {
+		uint8_t mode = RF_MUTE_TOGGLE;
+		if (args != NULL) {
+			mode = atoi(args) ? RF_MUTE_ON : RF_MUTE_OFF;
+		}
+		applyConsoleCommand(RF_CMD_MUTE, mode, 0);
+		printf("\n zone %d muted=%d", consoleZone, zones[consoleZone].muted);
+	}
 
-    _out(DDB0, DDRB); // LED1
-    _off(PB0, PORTB); // LED1 default 0
+	if (strcmp(cmd, "balance") == 0) {
+		if (args != NULL) {
+			applyConsoleCommand(RF_CMD_BALANCE, (uint8_t) atoi(args), 0);
+		}
+		printf("\n zone %d balance=%d", consoleZone, zones[consoleZone].offsets.balance);
+	}
+
+	if (strcmp(cmd, "trim") == 0) {
+		if (args != NULL) {
+			char *next;
+			char *end;
+			int8_t left = strtol(args, &next, 10);
+			int8_t right = strtol(next, &end, 10);
+
+			if (end == next) {
+				printf("\n trim needs <left> <right>");
+			} else {
+				applyConsoleCommand(RF_CMD_TRIM, (uint8_t) left, (uint8_t) right);
+			}
+		}
+		printf("\n zone %d trim left=%d right=%d", consoleZone, zones[consoleZone].offsets.trimLeft, zones[consoleZone].offsets.trimRight);
+	}
+
+	if (strcmp(cmd, "zone") == 0) {
+		if (args != NULL) {
+			uint8_t zone = atoi(args);
+			if (zone < ZONE_COUNT) {
+				consoleZone = zone;
+			}
+		}
+
+		for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+			const ZoneState *state = &zones[zone];
+			printf("\n%c%d volume=%d muted=%d balance=%d trim=%d/%d", (zone == consoleZone) ? '*' : ' ', zone,
+					state->volume, state->muted, state->offsets.balance, state->offsets.trimLeft, state->offsets.trimRight);
+		}
+	}
+
+#if IR_RECEIVER
+	if (strcmp(cmd, "ir") == 0) {
+		printf("\n IR errors=%u", getIRErrorCount());
+	}
+#endif
+
+	if (strcmp(cmd, "trace") == 0) {
+		TraceEntry entries[TRACE_SIZE];
+		uint8_t count = readTrace(entries, TRACE_SIZE);
+
+		for (uint8_t i = 0; i < count; i++) {
+			printf("\n %10lu event=%d arg=0x%02x", (unsigned long) entries[i].time, entries[i].event, entries[i].arg);
+		}
+	}
+
+	if (strcmp(cmd, "baud") == 0) {
+		if ((args != NULL) && (strcmp(args, "ok") == 0)) {
+			confirmConsoleBaud();
+		} else if (args != NULL) {
+			switchConsoleBaud(args);
+		}
+		printConsoleBauds();
+	}
+
+	if (strcmp(cmd, "supply") == 0) {
+		printf("\n AVcc=%umV boot=%umV monitored=%d power fails=%d", getSupplyMillivolts(), getBootSupplyMillivolts(),
+				isSupplyMonitored(), getPowerFailCount());
+	}
+
+	if (strcmp(cmd, "reset") == 0) {
+		softwareReset();
+	}
+
+	if (strcmp(cmd, "mem") == 0) {
+		MemoryInfo info;
+		getMemoryInfo(&info);
+		printf("\n data=%u bss=%u heap=%u", info.dataSize, info.bssSize, info.heapSize);
+		printf("\n stack=%u peak=%u", info.stackSize, info.stackPeak);
+		printf("\n free=%u headroom=%u (of %u)", info.freeNow, info.headroom, RAMEND - RAMSTART + 1);
+	}
 }
 
-void initTWI() {
-    //set SCL to ?kHz
-    TWSR = (1<<TWPS1)|(0<<TWPS0); // Prescaler Value = 16
-    TWBR = 0x02;
+/**
+ * Level of one channel: zone volume plus its trim, plus the balance when the
+ * balance leans away from it.
+ */
+static uint8_t channelLevel(uint8_t volume, int8_t trim, int8_t balance) {
+	int16_t level = (int16_t) volume + trim + ((balance > 0) ? balance : 0);
 
-    //enable TWI
-    TWCR = (1<<TWEN);
+	if (level < 0) {
+		return 0;
+	}
+	if (level > VOLUME_MAX) {
+		return VOLUME_MAX;
+	}
+	return level;
 }
 
-void sendTWI() {
+/**
+ * Stages both channels and the mute state of every changed zone (or of all
+ * zones), then flushes all sinks in one pass over the zones. That is not one
+ * bus transaction: each sink with something staged sends its own START ...
+ * STOP, a muxed sink adds a mux write when the segment changes.
+ */
+void sendZones(bool all) {
+	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+		ZoneState *state = &zones[zone];
+		if (!all && !state->changed) {
+			continue;
+		}
+		state->changed = false;
 
-    uint8_t b = volume/10 & 0b0000111;  //get the most significant digit (eg. 79 gets 7) and limit the most significant digit to 3 bit (7)
-    uint8_t a = volume%10;  //get the least significant digit (eg. 79 gets 9)
+		//printf("\nsend zone %d volume %d", zone, state->volume);
+		zoneSinks.setChannels(zone, channelLevel(state->volume, state->offsets.trimLeft, state->offsets.balance),
+				channelLevel(state->volume, state->offsets.trimRight, -state->offsets.balance));
+		zoneSinks.setMute(zone, state->muted);
+	}
 
-	// Send START condition
-	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN);
+	if (!zoneSinks.flush()) {
+		traceEvent(TRACE_BUS_ERROR, 0);
+	}
+}
 
-	// Wait for TWINT Flag set. This indicates that the START condition has been transmitted
-	while ((TWCR & (1<<TWINT)) == 0);
+/**
+ * Sends BOOT_VOLUME to all zones. The protection window of BOOT_PROTECT_SECONDS
+ * only starts once the sinks took it, until then it is retried every
+ * BOOT_RETRY_MS (a PT2257 still in reset does not acknowledge).
+ */
+void sendBootVolume(uint64_t currentTimeCicles) {
+	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+		zoneSinks.setChannels(zone, BOOT_VOLUME, BOOT_VOLUME);
+	}
 
+	if (zoneSinks.flush()) {
+		bootState = BOOT_PROTECT;
+		bootTimeCicles = convertSecondsToCicles(BOOT_PROTECT_SECONDS);
+		return;
+	}
 
-	if ((TWSR & 0xF8) != START) {
-		printf("\nFailed START");
-	 	return;
+	if (bootState != BOOT_MUTE) {
+		traceEvent(TRACE_BUS_ERROR, 0); // once, not per retry
 	}
+	bootState = BOOT_MUTE;
+	bootTimeCicles = currentTimeCicles + MS_TO_CICLES(BOOT_RETRY_MS);
+}
 
-	//Load SLA_W into TWDR Register. Clear TWINT bit in TWCR to start transmission of address
-	TWDR = PT2257_ADDR;
-	TWCR = (1<<TWINT)|(1<<TWEN);
+/**
+ * Boot sequencer, driven from the main loop by the Timer 1 timebase.
+ *
+ *   BOOT_SETTLE   no bus access for BOOT_SETTLE_MS after power-on, then the
+ *                 protective volume goes out and the radio comes up
+ *   BOOT_MUTE     the protective volume is retried until it is taken
+ *   BOOT_PROTECT  ends on timeout, or on the first RF command when
+ *                 BOOT_RF_POLICY is BOOT_RF_HONOUR
+ *
+ * Commands queued meanwhile have already been applied to the target volume,
+ * which is sent when the window ends.
+ */
+void runBootSequencer(uint64_t currentTimeCicles) {
+	switch (bootState) {
+		case BOOT_SETTLE:
+			if (currentTimeCicles >= bootTimeCicles) {
+				// Amplifier first, the radio is not worth a loud start
+				sendBootVolume(currentTimeCicles);
+				startRadio(NULL);
+			}
+			break;
+
+		case BOOT_MUTE:
+			if (currentTimeCicles >= bootTimeCicles) {
+				sendBootVolume(currentTimeCicles);
+			}
+			break;
+
+		case BOOT_PROTECT:
+			if (((BOOT_RF_POLICY == BOOT_RF_HONOUR) && volChanged) || (currentTimeCicles >= bootTimeCicles)) {
+				bootState = BOOT_RUN;
+				volChanged = false;
+				sendZones(true);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
 
-	// Wait for TWINT Flag set. This indicates that the SLA+W has been transmitted, and ACK/NACK has been received.
-	while ((TWCR & (1<<TWINT)) == 0);
+bool volumeDown(ZoneState *zone, const RfCommand *cmd) {
+	if (zone->volume >= cmd->arg) {
+		zone->volume -= cmd->arg;
+	}
+	return true;
+}
 
-	if ((TWSR & 0xF8) != MT_SLA_ACK) {
-		printf("\nFailed MT_SLA_ACK");
-	 	return;
+bool volumeUp(ZoneState *zone, const RfCommand *cmd) {
+	if (zone->volume < VOLUME_MAX) {
+		zone->volume += cmd->arg;
 	}
+	return true;
+}
 
-	// Load DATA1 into TWDR Register. Clear TWINT bit in TWCR to start transmission of data
-	TWDR = 0b11100000 | b;
-	TWCR = (1<<TWINT)|(1<<TWEN);
+bool volumeSet(ZoneState *zone, const RfCommand *cmd) {
+	zone->volume = cmd->arg;
+	return true;
+}
 
-	// Wait for TWINT Flag set. This indicates that the DATA has been transmitted, and ACK/NACK has been received.
-	while ((TWCR & (1<<TWINT)) == 0);
+bool volumeStep(ZoneState *zone, const RfCommand *cmd) {
+	int16_t level = (int16_t) zone->volume + (int8_t) cmd->arg;
+	zone->volume = (level < 0) ? 0 : level;
+	return true;
+}
 
-	if ((TWSR & 0xF8) != MT_DATA_ACK) {
-		printf("\nFailed MT_DATA_ACK 1");
-	 	return;
+bool volumeQuery(ZoneState *zone, const RfCommand *cmd) {
+	// Nothing to change, the frame only asks for the current state
+	return false;
+}
+
+bool volumeMute(ZoneState *zone, const RfCommand *cmd) {
+	if (cmd->arg == RF_MUTE_TOGGLE) {
+		zone->muted = !zone->muted;
+	} else {
+		zone->muted = (cmd->arg == RF_MUTE_ON);
 	}
+	return true;
+}
+
+static int8_t clampOffset(int8_t offset) {
+	if (offset > CHANNEL_OFFSET_MAX) {
+		return CHANNEL_OFFSET_MAX;
+	}
+	if (offset < -CHANNEL_OFFSET_MAX) {
+		return -CHANNEL_OFFSET_MAX;
+	}
+	return offset;
+}
 
-	// Load DATA2 into TWDR Register. Clear TWINT bit in TWCR to start transmission of data
-	TWDR = 0b11010000 | a;
-	TWCR = (1<<TWINT)|(1<<TWEN);
+bool volumeBalance(ZoneState *zone, const RfCommand *cmd) {
+	zone->offsets.balance = clampOffset((int8_t) cmd->arg);
+	zone->offsetsChanged = true;
+	return true;
+}
 
-	// Wait for TWINT Flag set. This indicates that the DATA has been transmitted, and ACK/NACK has been received.
-	while ((TWCR & (1<<TWINT)) == 0);
+bool volumeTrim(ZoneState *zone, const RfCommand *cmd) {
+	zone->offsets.trimLeft = clampOffset((int8_t) cmd->arg);
+	zone->offsets.trimRight = clampOffset((int8_t) cmd->arg2);
+	zone->offsetsChanged = true;
+	return true;
+}
 
-	if ((TWSR & 0xF8) != MT_DATA_ACK) {
-		printf("\nFailed MT_DATA_ACK 2");
-	 	return;
+// Returns true if the zone has to be sent to its sink
+typedef bool (*RfCommandHandler)(ZoneState *zone, const RfCommand *cmd);
+
+// Indexed by RfCommandType
+static constexpr RfCommandHandler rfCommandHandlers[] = {
+	volumeQuery,   // RF_CMD_NONE, never dispatched
+	volumeDown,    // RF_CMD_VOLUME_DOWN
+	volumeUp,      // RF_CMD_VOLUME_UP
+	volumeSet,     // RF_CMD_VOLUME_SET
+	volumeStep,    // RF_CMD_VOLUME_STEP
+	volumeQuery,   // RF_CMD_QUERY
+	volumeMute,    // RF_CMD_MUTE
+	volumeBalance, // RF_CMD_BALANCE
+	volumeTrim     // RF_CMD_TRIM
+};
+
+static_assert(sizeof(rfCommandHandlers) / sizeof(rfCommandHandlers[0]) == RF_CMD_COUNT, "rfCommandHandlers out of sync with RfCommandType");
+
+void applyRfCommand(const RfCommand *cmd) {
+	if (cmd->zone >= ZONE_COUNT) {
+		return;
 	}
 
-	// Transmit STOP condition
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+	ZoneState *zone = &zones[cmd->zone];
+
+	traceEvent(TRACE_RF_COMMAND, cmd->type | (cmd->zone << 5));
+
+	if (rfCommandHandlers[cmd->type](zone, cmd)) {
+		if (zone->volume > VOLUME_MAX) {
+			zone->volume = VOLUME_MAX;
+		}
+
+		zone->changed = true;
+		volChanged = true;
+		lastChangedZone = cmd->zone;
+		stateVersion++;
+	}
 }
 
-void handle_usart_cmd(char *cmd, char *args) {
-	if (strcmp(cmd, "test") == 0) {
-		printf("\n TEST [%s]", args);
+/**
+ * Handles a binary host frame (see hostcmd.h), called by usart_check_loop().
+ */
+void handle_usart_frame(uint8_t type, uint8_t *body, uint8_t len) {
+	uint8_t reply[HOST_REPLY_MAX];
+	uint8_t replyLen = 0;
+	uint8_t error = 0;
+
+	traceEvent(TRACE_HOST, type);
+
+	switch (type) {
+	case HOST_GET_VOLUME:
+		if ((len < 1) || (body[0] >= ZONE_COUNT)) {
+			error = USART_NAK_ARGS;
+			break;
+		}
+		replyLen = encodeZoneState(body[0], reply);
+		break;
+
+	case HOST_SET_VOLUME: {
+		if ((len < 2) || (body[0] >= ZONE_COUNT)) {
+			error = USART_NAK_ARGS;
+			break;
+		}
+		RfCommand cmd = { RF_CMD_VOLUME_SET, body[1], 0, false, 0, true, body[0] };
+		applyLocalCommand(&cmd);
+		replyLen = encodeZoneState(body[0], reply);
+		break;
 	}
 
-	if (strcmp(cmd, "send1") == 0) {
-		printf("\nsendTWI");
-		sendTWI();
+	case HOST_RF_COMMAND: {
+		RfCommand cmd;
+		if (!decodeRfFrame(body, len, &cmd)) {
+			error = USART_NAK_ARGS;
+			break;
+		}
+		if (!cmd.hasZone) {
+			cmd.hasZone = true;
+			cmd.zone = consoleZone;
+		}
+		if ((cmd.type == RF_CMD_VOLUME_UP) || (cmd.type == RF_CMD_VOLUME_DOWN)) {
+			cmd.arg = 1; // no pipe to give the step size
+		}
+		if (cmd.zone >= ZONE_COUNT) {
+			error = USART_NAK_ARGS;
+			break;
+		}
+		applyLocalCommand(&cmd);
+		replyLen = encodeZoneState(cmd.zone, reply);
+		break;
 	}
 
-	if (strcmp(cmd, "send2") == 0) {
-		uint8_t spi_cmd = (0<<VC1)|(1<<VC0)|(1<<VP1)|(1<<VP0);
-		uint8_t spi_data = atoi(args);
-		uint16_t spi_packet = (((uint16_t) spi_cmd) << 8) | (uint16_t) spi_data;
-		send_spi(spi_packet);
+	case HOST_GET_STATS:
+		replyLen = encodeHostStats(reply);
+		break;
+
+	case HOST_GET_CONFIG:
+		reply[replyLen++] = radioChannel;
+		reply[replyLen++] = radioProfile;
+		reply[replyLen++] = ZONE_COUNT;
+		reply[replyLen++] = TAPER_STEPS;
+		reply[replyLen++] = VOLUME_SINK;
+		reply[replyLen++] = POT_DRIVER;
+		reply[replyLen++] = IR_RECEIVER ? IR_PROTOCOL + 1 : 0;
+		reply[replyLen++] = RF_PROTOCOL_VERSION;
+		break;
+
+	case HOST_GET_TRACE: {
+		TraceEntry entries[TRACE_SIZE];
+		uint8_t count = readTrace(entries, TRACE_SIZE);
+		uint8_t skip = (len > 0) ? body[0] : 0;
+
+		reply[replyLen++] = count;
+		if (skip < count) {
+			uint8_t sent = count - skip;
+			if (sent > HOST_TRACE_ENTRIES) {
+				sent = HOST_TRACE_ENTRIES;
+			}
+			memcpy(&reply[replyLen], &entries[skip], sent * sizeof(TraceEntry));
+			replyLen += sent * sizeof(TraceEntry);
+		}
+		break;
+	}
+
+	default:
+		error = USART_NAK_UNKNOWN;
+	}
+
+	if (error != 0) {
+		uint8_t nak[2] = { type, error };
+		usart_send_frame(USART_FRAME_NAK, nak, sizeof(nak));
+	} else {
+		usart_send_frame(type | USART_FRAME_REPLY, reply, replyLen);
 	}
 }
 
-void send_spi(uint16_t data) {
-	_off(PC2, PORTC); // Enable CSN
+uint8_t encodeZoneState(uint8_t zone, uint8_t *data) {
+	const ZoneState *state = &zones[zone];
+
+	data[0] = zone;
+	data[1] = state->volume;
+	data[2] = state->muted;
+	data[3] = state->offsets.balance;
+	data[4] = state->offsets.trimLeft;
+	data[5] = state->offsets.trimRight;
+	data[6] = stateVersion;
+	return HOST_ZONE_REPLY_LEN;
+}
 
-	uint8_t i = 15;
-	do {
-		_off(PC1, PORTC); // 0 -> SCK
+static uint8_t putWord(uint8_t *data, uint16_t value) {
+	data[0] = value;
+	data[1] = value >> 8;
+	return 2;
+}
 
-		_delay_loop_1(10);
+/**
+ * HOST_GET_STATS reply: supply mV (16), power fails (8), IR errors (16), host
+ * frame errors (16), TX packets (16), failed (16), retries (32), lost (8), then
+ * for pipes 1-5 accepted, denied, rate limited, arbitrated and duplicates (16 each).
+ */
+uint8_t encodeHostStats(uint8_t *data) {
+	uint8_t len = 0;
+
+	len += putWord(&data[len], getSupplyMillivolts());
+	data[len++] = getPowerFailCount();
+#if IR_RECEIVER
+	len += putWord(&data[len], getIRErrorCount());
+#else
+	len += putWord(&data[len], 0);
+#endif
+	len += putWord(&data[len], usart_frame_errors());
+
+	rf24_tx_stats_t tx;
+	uint8_t eimsk = EIMSK;
+	_off(INT0, EIMSK);
+	radio.getTxStats(tx);
+	EIMSK = eimsk;
+
+	len += putWord(&data[len], tx.packets);
+	len += putWord(&data[len], tx.failed);
+	len += putWord(&data[len], tx.retries);
+	len += putWord(&data[len], tx.retries >> 16);
+	data[len++] = tx.lost;
+
+	for (uint8_t pipe = PIPE_FIRST_READ; pipe < PIPE_COUNT; pipe++) {
+		PipeStats stats;
+		getPipeStats(pipe, &stats);
+
+		len += putWord(&data[len], stats.accepted);
+		len += putWord(&data[len], stats.denied);
+		len += putWord(&data[len], stats.rateLimited);
+		len += putWord(&data[len], stats.arbitrated);
+		len += putWord(&data[len], getDuplicateCount(pipe));
+	}
 
-		if (GET_REG1_FLAG(data, i)) {
-			_on(PC0, PORTC); // 1 -> SI
-		} else {
-			_off(PC0, PORTC); // 0 -> SI
+	return len;
+}
+
+/**
+ * Runs a console command through the RF command path, so it is applied,
+ * versioned and reported to the controllers the same way.
+ */
+void applyConsoleCommand(uint8_t type, uint8_t arg, uint8_t arg2) {
+	RfCommand cmd;
+	cmd.type = type;
+	cmd.arg = arg;
+	cmd.arg2 = arg2;
+	cmd.hasSeq = false;
+	cmd.seq = 0;
+	cmd.hasZone = true;
+	cmd.zone = consoleZone;
+
+	applyLocalCommand(&cmd);
+}
+
+/**
+ * Applies a command from the console or the IR remote, with the radio
+ * interrupt masked: the radio ISR applies commands and writes ACK payloads too.
+ */
+void applyLocalCommand(const RfCommand *cmd) {
+	uint8_t eimsk = EIMSK; // INT0 stays off until the radio is up
+	_off(INT0, EIMSK);
+	applyRfCommand(cmd);
+	refreshAckPayloads(0);
+	EIMSK = eimsk;
+}
+
+/**
+ * Feeds the last key decoded by the IR receiver into the command path.
+ * A held key repeats volume steps only, after SKIP_REPEATED_IR repeat frames
+ * (~108 ms each), so a short press is a single step.
+ */
+void handleIRKeys() {
+	IrCode code;
+	RfCommand cmd;
+
+	if (!readIRCode(&code) || !mapIRKey(&code, &cmd)) {
+		return;
+	}
+
+	if (!code.repeat) {
+		irRepeats = 0;
+	} else {
+		if (cmd.type != RF_CMD_VOLUME_STEP) {
+			return;
+		}
+		if (irRepeats < SKIP_REPEATED_IR) {
+			irRepeats++;
+			return;
 		}
+	}
 
-		_delay_loop_1(10);
+	traceEvent(TRACE_IR_KEY, code.command);
+	applyLocalCommand(&cmd);
+}
 
-		_on(PC1, PORTC); // 1 -> SCK
-		_delay_loop_1(40);
-	} while (i--);
+/**
+ * Brings up the radio from the register image saved in EEPROM, which skips
+ * the variant probe and settling delay of a full begin(). Falls back to the
+ * full configuration when there is no valid image or the chip does not
+ * take it. Returns true if the image was used.
+ */
+bool initRadio() {
+	rf24_image_t image;
+
+	radioProfile = eeprom_read_byte(EEPROM_RADIO_PROFILE);
+
+	// An image with dynamic payloads below PIPE_FIRST_DYNAMIC is of an older
+	// build, the deployed controllers could not reach pipe 1 with it
+	bool fromImage = loadRadioImage(&image) && ((image.dynpd & (_BV(PIPE_FIRST_DYNAMIC) - 1)) == 0) && radio.begin(image);
+
+	if (fromImage) {
+		radioChannel = image.rf_ch;
+	} else {
+		radio.begin();
+
+		// Stored radio profile, long range is the factory setting
+		if (!applyRadioProfile(radio, radioProfile)) {
+			radioProfile = RADIO_PROFILE_LONG_RANGE;
+			applyRadioProfile(radio, radioProfile);
+		}
 
-	_off(PC1, PORTC); // 0 -> SCK
-	_delay_loop_1(40);
+		radio.setPALevel(RF24_PA_MAX);
+		radio.setChannel(radioChannel);
+	}
 
-	_off(PC0, PORTC); // 0 -> SI
-	_on(PC2, PORTC); // Disable CSN
-	_delay_loop_1(5);
+	// Adaptation is driver state, the image only holds its starting point
+	const RadioProfile *profile = getRadioProfile(radioProfile);
+	if (profile != 0) {
+		radio.setAdaptiveRetries(true, profile->retryDelay, 15, 3, profile->retryCount);
+	}
+
+	return fromImage;
 }
 
-void sendVolume() {
-	//printf("\nsend  volume %d", volume);
-	sendTWI();
+/**
+ * Configures the radio and starts listening, INT0 is enabled last. warm is
+ * the state of a warm restart, NULL after power-on.
+ */
+void startRadio(const WarmState *warm) {
+	// A full watchdog period for the bring-up (a few ms of settling delays)
+	wdt_reset();
+	bool radioFromImage = initRadio();
+
+	if ((warm != NULL) && (radioChannel != warm->radioChannel)) {
+		// 'scan auto' picked a channel which has not made it to the image
+		radioChannel = warm->radioChannel;
+		radio.setChannel(radioChannel);
+	}
+
+	radio.openWritingPipe(writingPipe);
+	openReadingPipes();
+
+	if (!radioFromImage) {
+		storeRadioImage();
+	}
+
+	radio.startListening();
+
+#if SCAN_ON_BOOT
+	runChannelScan(SCAN_ON_BOOT == 2);
+#endif
+
+#if PRINT_RADIO_DETAILS
+	radio.printDetails();
+#endif
+
+	radioReady = true;
+	refreshAckPayloads(0);
+	updateWarmState();
+
+	_on(INTF0, EIFR); // drop edges seen before the chip was configured
+	_on(INT0, EIMSK);
 }
 
-void initLowVolume() {
-    volume = 70;
+/**
+ * Copies the live state into the .noinit block used by a warm restart.
+ */
+void updateWarmState() {
+	WarmState warm;
+	warm.mutedZones = 0;
+	for (uint8_t zone = 0; zone < ZONE_COUNT; zone++) {
+		warm.volume[zone] = zones[zone].volume;
+		if (zones[zone].muted) {
+			warm.mutedZones |= _BV(zone);
+		}
+	}
+	warm.stateVersion = stateVersion;
+	warm.radioChannel = radioChannel;
+	saveWarmState(&warm);
+}
 
-    // set min volume
-    sendVolume();
+/**
+ * Power-fail save of the zone changed last, run by the ADC interrupt as soon
+ * as it saw AVcc fall. One bounded EEPROM write, if the volume differs.
+ */
+void savePowerFailZone() {
+	_off(LED_PIN, PORTB); // the LED draws from the hold-up budget
+
+	uint8_t zone = lastChangedZone;
+	uint8_t volume = zones[zone].volume;
+	if (volume != zones[zone].savedVolume) {
+		saveZoneVolumeFromISR(zone, volume);
+		zones[zone].savedVolume = volume;
+	}
+}
 
-    for (int i = 0; i < 10; i++) {
-    	_delay_ms(1000);
-    }
+/**
+ * Rest of the power-fail save, run by the main loop after savePowerFailZone()
+ * while the supply capacitors still hold AVcc up. Only zones whose volume
+ * differs from EEPROM are written, up to POWER_FAIL_ZONES writes in all.
+ * Balance and trim are left to the deferred job.
+ */
+void saveStateOnPowerFail() {
+	traceEvent(TRACE_POWER_FAIL, getPowerFailCount());
+
+	uint8_t writes = 1; // savePowerFailZone()
+	uint8_t zone = lastChangedZone;
+	for (uint8_t i = 0; (i < ZONE_COUNT) && (writes < POWER_FAIL_ZONES); i++) {
+		if (saveZoneIfChanged(zone)) {
+			writes++;
+		}
+		zone = (zone + 1 < ZONE_COUNT) ? zone + 1 : 0;
+	}
+}
+
+/**
+ * Writes the zone volume to EEPROM if it differs from the saved one, true if
+ * it did (one ~3.4 ms write).
+ */
+bool saveZoneIfChanged(uint8_t zone) {
+	uint8_t volume = zones[zone].volume;
+	if (volume == zones[zone].savedVolume) {
+		return false;
+	}
+
+	saveZoneVolume(zone, volume);
+	zones[zone].savedVolume = volume;
+	return true;
+}
+
+void storeRadioImage() {
+	rf24_image_t image;
+	radio.captureImage(image);
+	saveRadioImage(&image);
+}
+
+/**
+ * Opens every reading pipe which has an address in the pipe policy table.
+ * Pipes from PIPE_FIRST_DYNAMIC on get dynamic payloads and ACK payloads.
+ */
+void openReadingPipes() {
+	for (uint8_t pipe = PIPE_FIRST_READ; pipe < PIPE_COUNT; pipe++) {
+		PipePolicy policy;
+		getPipePolicy(pipe, &policy);
+
+		if (policy.address != 0) {
+			radio.openReadingPipe(pipe, policy.address);
+			if (pipe >= PIPE_FIRST_DYNAMIC) {
+				radio.enableAckPayload(pipe);
+			}
+			readingPipes |= _BV(pipe);
+		}
+	}
+}
+
+/**
+ * Handles the pending host frame in gateway mode. Frames for RF go out on the
+ * address given by the host, the receiver is back on its own pipes right after.
+ */
+void runGateway() {
+	GatewayHostFrame frame;
+
+	// Radio frames copied by the radio interrupt go out first
+	pumpGateway();
+
+	if (!readHostFrame(&frame)) {
+		return;
+	}
+
+	switch (frame.type) {
+	case GW_HOST_TX: {
+		uint8_t len = frame.len - GW_ADDRESS_LEN;
+		if ((frame.len <= GW_ADDRESS_LEN) || (len > RF_PAYLOAD_MAX)) {
+			sendGatewayTxStatus(false);
+			break;
+		}
+
+		uint64_t address = 0;
+		for (uint8_t i = GW_ADDRESS_LEN; i > 0; i--) {
+			address = (address << 8) | frame.body[i - 1];
+		}
+
+		suspendRadio();
+		radio.openWritingPipe(address);
+		bool delivered = radio.write(&frame.body[GW_ADDRESS_LEN], len);
+		radio.openWritingPipe(writingPipe);
+		resumeRadio();
+
+		sendGatewayTxStatus(delivered);
+		break;
+	}
+
+	case GW_HOST_STATS:
+		sendGatewayStats();
+		break;
+
+	case GW_HOST_RESET_STATS:
+		resetGatewayStats();
+		sendGatewayStats();
+		break;
+	}
+}
+
+/**
+ * Sweeps all channels and prints the occupancy, optionally moving to the
+ * quietest allowed channel. RF commands are not served during the sweep.
+ */
+void runChannelScan(bool autoSelect) {
+	suspendRadio();
+
+	scanChannels(radio);
+	printChannelHistogram();
+
+	if (autoSelect) {
+		radioChannel = findQuietestChannel();
+	}
+	printf("\n channel %d", radioChannel);
+
+	radio.setChannel(radioChannel);
+	if (autoSelect) {
+		storeRadioImage();
+		updateWarmState();
+	}
+	resumeRadio();
+}
+
+/**
+ * Sends QUERY frames on the writing pipe to exercise the transmit path and
+ * its retry adaptation, see 'txstat' for the outcome.
+ */
+void runTxTest(uint8_t count) {
+	uint8_t frame[1] = { RF_HEADER(RF_OP_QUERY) };
+	uint8_t delivered = 0;
+
+	suspendRadio();
+
+	for (uint8_t i = 0; i < count; i++) {
+		wdt_reset();
+		if (radio.write(frame, sizeof(frame))) {
+			delivered++;
+		}
+	}
+	printf("\n delivered %d/%d", delivered, count);
+
+	resumeRadio();
+}
+
+/**
+ * Takes the radio out of RX and masks its interrupt, so the main loop can
+ * reconfigure it or use it for transmitting.
+ */
+void suspendRadio() {
+	_off(INT0, EIMSK);
+	radio.stopListening();
+}
+
+void resumeRadio() {
+	radio.startListening();
+	refreshAckPayloads(0);
+
+	_on(INTF0, EIFR); // drop the edges seen while suspended
+	_on(INT0, EIMSK);
+}
+
+/**
+ * Lists the radio profiles with their modelled timing of one command.
+ */
+void printRadioProfiles() {
+	for (uint8_t id = 0; id < RADIO_PROFILE_COUNT; id++) {
+		RadioTiming timing;
+		modelRadioTiming(id, &timing);
+
+		printf("\n%c%d %-11s air=%uus ack=%uus exchange=%uus retry=%uus worst=%uus",
+				(id == radioProfile) ? '*' : ' ', id, getRadioProfile(id)->name,
+				timing.packet, timing.ack, timing.exchange, timing.retry, timing.worstCase);
+	}
+}
+
+/**
+ * 'baud <rate> [8N1|8E2|...]': switches the console right away, the host has
+ * BAUD_CONFIRM_SECONDS to answer 'baud ok' at the new setting, otherwise the
+ * last confirmed one comes back. Nothing is stored before the confirmation.
+ */
+void switchConsoleBaud(char *args) {
+	char *next;
+	uint32_t baud = strtoul(args, &next, 10);
+	while (*next == ' ') {
+		next++;
+	}
+
+	int16_t format = (*next != 0) ? usart_parse_format(next) : usart_get_format();
+	if (format < 0) {
+		printf("\n format %s not supported", next);
+		return;
+	}
+
+	uint32_t previousBaud = usart_get_baud();
+	uint8_t previousFormat = usart_get_format();
+
+	printf("\n switching, confirm with 'baud ok' within %d s", BAUD_CONFIRM_SECONDS);
+	if (!usart_configure(baud, format)) {
+		printf("\n %lu baud not supported", (unsigned long) baud);
+		return;
+	}
+
+	// Switching again before confirming still falls back to the confirmed setting
+	if (baudRevertCicles == 0) {
+		consoleFallback.baud = previousBaud;
+		consoleFallback.format = previousFormat;
+	}
+	baudRevertCicles = convertSecondsToCicles(BAUD_CONFIRM_SECONDS);
+	traceEvent(TRACE_BAUD, usart_get_format());
+}
+
+/**
+ * The host reached us at the new setting, keep it across resets.
+ */
+void confirmConsoleBaud() {
+	if (baudRevertCicles == 0) {
+		return;
+	}
+
+	ConsoleConfig config = { usart_get_baud(), usart_get_format() };
+	saveConsoleConfig(&config);
+	baudRevertCicles = 0;
+}
+
+void revertConsoleBaud() {
+	baudRevertCicles = 0;
+	usart_configure(consoleFallback.baud, consoleFallback.format);
+	traceEvent(TRACE_BAUD, TRACE_BAUD_REVERTED);
+
+	printf("\n baud not confirmed, reverted");
+	printf(CONSOLE_PREFIX);
+}
+
+/**
+ * Current line setting and the table rates with their error at this F_CPU.
+ */
+void printConsoleBauds() {
+	char name[4];
+	usart_format_name(usart_get_format(), name);
+	printf("\n console %lu %s%s", (unsigned long) usart_get_baud(), name, (baudRevertCicles != 0) ? " unconfirmed" : "");
+
+	for (uint8_t i = 0; i < usart_baud_count(); i++) {
+		uint8_t error;
+		bool u2x;
+		uint32_t baud = usart_baud_rate(i, &error, &u2x);
+
+		printf("\n%c%6lu error=%d.%d%%%s%s", (baud == usart_get_baud()) ? '*' : ' ', (unsigned long) baud,
+				error / 10, error % 10, u2x ? " U2X" : "", (error > USART_BAUD_TOLERANCE) ? " unusable" : "");
+	}
+}
+
+/**
+ * Replaces the pending ACK payloads with the current state, so the next
+ * transmission of any controller on a dynamic pipe gets it back without an
+ * extra packet.
+ *
+ * The TX FIFO holds only 3 payloads, the pipes in firstPipes (the ones that
+ * just consumed theirs) are served first, then the remaining open pipes.
+ */
+void refreshAckPayloads(uint8_t firstPipes) {
+	const uint8_t ackPayloadSlots = 3;
+
+	// Written by startRadio(), the chip may still be in its power-on reset
+	if (!radioReady) {
+		return;
+	}
+
+	// Stale replies would otherwise be sent first
+	radio.flush_tx();
+
+	uint8_t slots = ackPayloadSlots;
+	uint8_t order[2] = { (uint8_t) (firstPipes & readingPipes), (uint8_t) (readingPipes & ~firstPipes) };
+
+	for (uint8_t i = 0; i < 2; i++) {
+		for (uint8_t pipe = PIPE_FIRST_DYNAMIC; (pipe < PIPE_COUNT) && (slots > 0); pipe++) {
+			if (order[i] & _BV(pipe)) {
+				// Each controller hears about the zone of its pipe
+				PipePolicy policy;
+				getPipePolicy(pipe, &policy);
+				const ZoneState *zone = &zones[policy.zone];
+
+				uint8_t reply[RF_STATE_REPLY_LEN];
+				uint8_t len = encodeStateReply(reply, zone->volume, zone->muted, stateVersion, policy.zone);
+				radio.writeAckPayload(pipe, reply, len);
+				slots--;
+			}
+		}
+	}
 }
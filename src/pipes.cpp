@@ -0,0 +1,128 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+#include <string.h>
+
+#include "pipes.h"
+#include "zones.h"
+#include "../atmega328/mtimer.h"
+
+/********************************************************************************
+	Policy Table
+********************************************************************************/
+// One controller per pipe, pipe 0 stays closed (used for writing).
+static const PipePolicy pipePolicies[PIPE_COUNT] PROGMEM = {
+	// address         permissions                                            step  rate limit          priority  zone
+	{ 0,               0,                                                     0,    0,                  0,        0 },
+	{ 0xF0F0F0F0D2LL,  PIPE_ALLOW_ALL,                                        2,    0,                  2,        0 }, // wall remote
+	{ 0xF0F0F0F0C3LL,  PIPE_ALLOW_ALL,                                        2,    MS_TO_CICLES(50),   1,        0 }, // PC app
+	{ 0xF0F0F0F0B4LL,  PIPE_ALLOW_STEP | PIPE_ALLOW_QUERY | PIPE_ALLOW_MUTE,  2,    MS_TO_CICLES(100),  0,        0 }, // phone bridge
+	{ 0,               0,                                                     0,    0,                  0,        0 },
+	{ 0,               0,                                                     0,    0,                  0,        0 }
+};
+
+// Permission needed by each RfCommandType
+static const uint8_t commandPermissions[RF_CMD_COUNT] PROGMEM = {
+	0,                // RF_CMD_NONE
+	PIPE_ALLOW_STEP,  // RF_CMD_VOLUME_DOWN
+	PIPE_ALLOW_STEP,  // RF_CMD_VOLUME_UP
+	PIPE_ALLOW_SET,   // RF_CMD_VOLUME_SET
+	PIPE_ALLOW_STEP,  // RF_CMD_VOLUME_STEP
+	PIPE_ALLOW_QUERY, // RF_CMD_QUERY
+	PIPE_ALLOW_MUTE,  // RF_CMD_MUTE
+	PIPE_ALLOW_TRIM,  // RF_CMD_BALANCE
+	PIPE_ALLOW_TRIM   // RF_CMD_TRIM
+};
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static PipeStats pipeStats[PIPE_COUNT];
+static uint64_t pipeLastAccepted[PIPE_COUNT];
+
+// Owner of the current coalescing window, controllers of different zones do not compete
+static uint8_t windowPriority[ZONE_COUNT];
+static uint64_t windowEnd[ZONE_COUNT];
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+void getPipePolicy(uint8_t pipe, PipePolicy *policy) {
+	memcpy_P(policy, &pipePolicies[pipe], sizeof(PipePolicy));
+}
+
+/**
+ * Applies the pipe policy to a decoded command.
+ *
+ * Checks permissions and the rate limit, then arbitrates against commands
+ * of other pipes in the same coalescing window: a lower priority pipe loses
+ * to a higher one, equal priorities are applied in arrival order.
+ * Up/down commands get the step size of the pipe as their argument, commands
+ * without a zone prefix the zone of the pipe.
+ */
+bool admitPipeCommand(uint8_t pipe, RfCommand *cmd) {
+	if (pipe >= PIPE_COUNT) {
+		return false;
+	}
+
+	PipePolicy policy;
+	getPipePolicy(pipe, &policy);
+	PipeStats *stats = &pipeStats[pipe];
+
+	if ((policy.permissions & pgm_read_byte(&commandPermissions[cmd->type])) == 0) {
+		stats->denied++;
+		return false;
+	}
+
+	if (!cmd->hasZone) {
+		cmd->zone = policy.zone;
+	} else if ((cmd->zone != policy.zone) && !(policy.permissions & PIPE_ALLOW_ZONES)) {
+		stats->denied++;
+		return false;
+	}
+
+	if (cmd->zone >= ZONE_COUNT) {
+		stats->denied++;
+		return false;
+	}
+
+	// Queries change nothing, there is nothing to limit or arbitrate
+	if (cmd->type == RF_CMD_QUERY) {
+		stats->accepted++;
+		return true;
+	}
+
+	uint64_t now = getCurrentTimeCicles();
+
+	if ((policy.minInterval != 0) && (pipeLastAccepted[pipe] != 0) && (now - pipeLastAccepted[pipe] < policy.minInterval)) {
+		stats->rateLimited++;
+		return false;
+	}
+
+	if (now < windowEnd[cmd->zone]) {
+		if (policy.priority < windowPriority[cmd->zone]) {
+			stats->arbitrated++;
+			return false;
+		}
+	} else {
+		windowEnd[cmd->zone] = now + MS_TO_CICLES(PIPE_COALESCE_MS);
+	}
+	windowPriority[cmd->zone] = policy.priority;
+
+	if ((cmd->type == RF_CMD_VOLUME_UP) || (cmd->type == RF_CMD_VOLUME_DOWN)) {
+		cmd->arg = policy.step;
+	}
+
+	pipeLastAccepted[pipe] = now;
+	stats->accepted++;
+	return true;
+}
+
+void getPipeStats(uint8_t pipe, PipeStats *stats) {
+	// Updated by the radio interrupt
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		memcpy(stats, &pipeStats[pipe], sizeof(PipeStats));
+	}
+}
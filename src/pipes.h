@@ -0,0 +1,59 @@
+#ifndef PIPES_H_
+#define PIPES_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "protocol.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define PIPE_COUNT       6
+#define PIPE_FIRST_READ  1 // pipe 0 is shared with the writing pipe
+
+// Pipes from here on use dynamic payloads and get the state reply as ACK
+// payload. Below it the static payload size is kept: the deployed controllers
+// (pipe 1) send static payloads and the chip drops those on a DPL pipe.
+#define PIPE_FIRST_DYNAMIC 2
+
+// Permission bits
+#define PIPE_ALLOW_STEP  (1 << 0) // volume up/down/step
+#define PIPE_ALLOW_SET   (1 << 1) // absolute volume
+#define PIPE_ALLOW_QUERY (1 << 2)
+#define PIPE_ALLOW_MUTE  (1 << 3)
+#define PIPE_ALLOW_TRIM  (1 << 4) // balance and channel offsets, installer remotes
+#define PIPE_ALLOW_ZONES (1 << 5) // may address zones other than its own
+#define PIPE_ALLOW_ALL   0xFF
+
+// Commands from different pipes arriving within this window are arbitrated by priority
+#define PIPE_COALESCE_MS 150
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint64_t address;     // 0: pipe closed. Pipes 2-5 share bytes 1-4 with pipe 1
+	uint8_t permissions;  // PIPE_ALLOW_*
+	uint8_t step;         // volume change of a single up/down command
+	uint16_t minInterval; // rate limit between accepted commands, timer cicles
+	uint8_t priority;     // higher wins inside the coalescing window
+	uint8_t zone;         // zone of commands without a zone prefix
+} PipePolicy;
+
+typedef struct {
+	uint16_t accepted;
+	uint16_t denied;      // not permitted on this pipe
+	uint16_t rateLimited;
+	uint16_t arbitrated;  // lost against a higher priority pipe
+} PipeStats;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void getPipePolicy(uint8_t pipe, PipePolicy *policy);
+bool admitPipeCommand(uint8_t pipe, RfCommand *cmd);
+void getPipeStats(uint8_t pipe, PipeStats *stats);
+
+#endif /* PIPES_H_ */
@@ -0,0 +1,144 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include "protocol.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+// Host build (fuzzing, see host/), tables live in ordinary memory
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#endif
+
+/********************************************************************************
+	Opcode Table
+********************************************************************************/
+typedef struct {
+	uint8_t type;   // RfCommandType produced by the opcode
+	uint8_t argLen; // bytes following the header
+} RfOpcode;
+
+// Indexed by RF_OP_*, adding a command only adds a row here.
+static constexpr RfOpcode rfOpcodes[] PROGMEM = {
+	{ RF_CMD_VOLUME_DOWN, 0 }, // RF_OP_VOLUME_DOWN
+	{ RF_CMD_VOLUME_UP,   0 }, // RF_OP_VOLUME_UP
+	{ RF_CMD_VOLUME_SET,  1 }, // RF_OP_VOLUME_SET
+	{ RF_CMD_VOLUME_STEP, 1 }, // RF_OP_VOLUME_STEP
+	{ RF_CMD_QUERY,       0 }, // RF_OP_QUERY
+	{ RF_CMD_MUTE,        1 }, // RF_OP_MUTE
+	{ RF_CMD_BALANCE,     1 }, // RF_OP_BALANCE
+	{ RF_CMD_TRIM,        2 }, // RF_OP_TRIM
+	{ RF_CMD_NONE,        2 }, // RF_OP_ZONE, wraps another opcode
+};
+
+static_assert(sizeof(rfOpcodes) / sizeof(rfOpcodes[0]) == RF_OP_COUNT, "rfOpcodes out of sync with RF_OP_*");
+static_assert((RF_MAGIC0 >> RF_HEADER_VERSION_SHIFT) != RF_PROTOCOL_VERSION, "legacy magic must not read as a version 2 header");
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Looks up the opcode table for the frame body starting at args.
+ */
+static bool decodeOpcode(uint8_t op, const uint8_t *args, uint8_t argLen, RfCommand *cmd) {
+	if (op >= RF_OP_COUNT) {
+		return false;
+	}
+
+	uint8_t needed = pgm_read_byte(&rfOpcodes[op].argLen);
+	if (argLen < needed) {
+		return false;
+	}
+
+	if (op == RF_OP_ZONE) {
+		// Zone prefix, not nested
+		if (cmd->hasZone) {
+			return false;
+		}
+		cmd->hasZone = true;
+		cmd->zone = args[0];
+		return decodeOpcode(args[1], args + 2, argLen - 2, cmd);
+	}
+
+	cmd->type = pgm_read_byte(&rfOpcodes[op].type);
+	cmd->arg = (needed > 0) ? args[0] : 0;
+	cmd->arg2 = (needed > 1) ? args[1] : 0;
+	return true;
+}
+
+/**
+ * Decodes one RF payload into a command.
+ *
+ * Pure function without any hardware access, so it can be built and exercised
+ * on the host. Never reads past data[len - 1] and rejects widths larger than
+ * RF_PAYLOAD_MAX, truncated frames and unknown opcodes.
+ */
+bool decodeRfFrame(const uint8_t *data, uint8_t len, RfCommand *cmd) {
+	cmd->type = RF_CMD_NONE;
+	cmd->arg = 0;
+	cmd->arg2 = 0;
+	cmd->hasSeq = false;
+	cmd->seq = 0;
+	cmd->hasZone = false;
+	cmd->zone = 0;
+
+	if ((len < 1) || (len > RF_PAYLOAD_MAX)) {
+		return false;
+	}
+
+	// Legacy frame, still sent by the controllers already deployed. Matched
+	// before the table, so it costs no more than the inline check it replaced.
+	if (data[0] == RF_MAGIC0) {
+		if ((len < 4) || (data[1] != RF_MAGIC1) || (data[2] != RF_MAGIC2)) {
+			return false;
+		}
+
+		switch (data[3]) {
+			case RF_LEGACY_VOLUME_DOWN:
+				cmd->type = RF_CMD_VOLUME_DOWN;
+				return true;
+			case RF_LEGACY_VOLUME_UP:
+				cmd->type = RF_CMD_VOLUME_UP;
+				return true;
+			case RF_LEGACY_VOLUME_SET:
+				if (len < 5) {
+					return false;
+				}
+				cmd->type = RF_CMD_VOLUME_SET;
+				cmd->arg = data[4];
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint8_t header = data[0];
+
+	if ((header >> RF_HEADER_VERSION_SHIFT) == RF_PROTOCOL_VERSION) {
+		uint8_t offset = 1;
+		if (header & (1 << RF_HEADER_SEQUENCE)) {
+			if (len < 2) {
+				return false;
+			}
+			cmd->hasSeq = true;
+			cmd->seq = data[1];
+			offset = 2;
+		}
+		return decodeOpcode(header & RF_HEADER_OPCODE_MASK, data + offset, len - offset, cmd);
+	}
+
+	return false;
+}
+
+/**
+ * Builds the state reply preloaded as ACK payload, returns its length.
+ */
+uint8_t encodeStateReply(uint8_t *data, uint8_t volume, bool muted, uint8_t version, uint8_t zone) {
+	data[0] = RF_HEADER(RF_OP_STATE_REPLY);
+	data[1] = volume;
+	data[2] = muted ? (1 << RF_STATE_MUTED) : 0;
+	data[3] = version;
+	data[4] = zone;
+	return RF_STATE_REPLY_LEN;
+}
@@ -0,0 +1,97 @@
+#ifndef PROTOCOL_H_
+#define PROTOCOL_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+// Largest payload the nRF24L01(+) can deliver, anything wider is garbage.
+#define RF_PAYLOAD_MAX 32
+
+/*
+ * Frame format version 2: one header byte followed by the opcode arguments.
+ *
+ *   bit 7..6  protocol version (RF_PROTOCOL_VERSION)
+ *   bit 5     sequence flag, a sequence byte follows the header (a frame
+ *             without one resets the duplicate window of its pipe, see dedup.h)
+ *   bit 4..0  opcode (RF_OP_*)
+ *
+ * Version 1 is the legacy frame: 3 byte magic followed by the opcode and its
+ * arguments. The first magic byte (0b01101110) carries version 1 in bit 7..6,
+ * so both formats can be told apart from the first byte.
+ */
+#define RF_PROTOCOL_VERSION 2
+
+#define RF_HEADER_VERSION_SHIFT 6
+#define RF_HEADER_SEQUENCE      5
+#define RF_HEADER_OPCODE_MASK   0x1F
+
+#define RF_HEADER(op) ((RF_PROTOCOL_VERSION << RF_HEADER_VERSION_SHIFT) | (op))
+
+#define RF_OP_VOLUME_DOWN 0x00 // no arguments
+#define RF_OP_VOLUME_UP   0x01 // no arguments
+#define RF_OP_VOLUME_SET  0x02 // uint8_t level
+#define RF_OP_VOLUME_STEP 0x03 // int8_t delta
+#define RF_OP_QUERY       0x04 // no arguments, no state change
+#define RF_OP_MUTE        0x05 // uint8_t RF_MUTE_*, the volume is kept
+#define RF_OP_BALANCE     0x06 // int8_t steps, > 0 attenuates the left channel, < 0 the right one
+#define RF_OP_TRIM        0x07 // int8_t left, int8_t right: per-channel offsets in steps
+#define RF_OP_ZONE        0x08 // uint8_t zone, uint8_t opcode, arguments of that opcode
+#define RF_OP_COUNT       0x09
+
+#define RF_MUTE_OFF    0
+#define RF_MUTE_ON     1
+#define RF_MUTE_TOGGLE 2
+
+// Receiver -> controller only, sent back as ACK payload, never decoded
+#define RF_OP_STATE_REPLY 0x1F // uint8_t volume, uint8_t flags, uint8_t version, uint8_t zone
+#define RF_STATE_REPLY_LEN 5
+#define RF_STATE_MUTED     0  // flags bit
+
+// Legacy (version 1) frame
+#define RF_MAGIC0 110
+#define RF_MAGIC1 120
+#define RF_MAGIC2 130
+
+// Legacy opcodes, decoded without the opcode table
+#define RF_LEGACY_VOLUME_DOWN 100
+#define RF_LEGACY_VOLUME_UP   101
+#define RF_LEGACY_VOLUME_SET  102
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef enum {
+	RF_CMD_NONE = 0,
+	RF_CMD_VOLUME_DOWN,
+	RF_CMD_VOLUME_UP,
+	RF_CMD_VOLUME_SET,
+	RF_CMD_VOLUME_STEP,
+	RF_CMD_QUERY,
+	RF_CMD_MUTE,
+	RF_CMD_BALANCE,
+	RF_CMD_TRIM,
+	RF_CMD_COUNT
+} RfCommandType;
+
+typedef struct {
+	uint8_t type; // RfCommandType
+	uint8_t arg;  // raw argument byte, RF_CMD_VOLUME_STEP carries an int8_t
+	uint8_t arg2; // second argument byte, only RF_CMD_TRIM has one
+	bool hasSeq;  // frame carried a sequence byte
+	uint8_t seq;
+	bool hasZone; // frame addressed a zone, else the pipe decides
+	uint8_t zone;
+} RfCommand;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+bool decodeRfFrame(const uint8_t *data, uint8_t len, RfCommand *cmd);
+uint8_t encodeStateReply(uint8_t *data, uint8_t volume, bool muted, uint8_t version, uint8_t zone);
+
+#endif /* PROTOCOL_H_ */
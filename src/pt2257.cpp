@@ -0,0 +1,159 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <stdio.h>
+#include <util/delay.h>
+
+#include "pt2257.h"
+#include "../common/util.h"
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+// Segments enabled on the I2C switch, valid only after an acknowledged write
+static uint8_t muxSegments = 0;
+static bool muxValid = false;
+
+/********************************************************************************
+	TWI
+********************************************************************************/
+/**
+ * Frees a bus a reset left mid-transfer: a slave still holding SDA low gets
+ * up to 9 SCL clocks to shift out its byte, then a STOP is generated. Run
+ * with the TWI off, the lines are only pulled low or released to the
+ * pull-ups.
+ */
+void clearTWIBus() {
+	TWCR = 0;
+	_off(PC4, PORTC);
+	_off(PC5, PORTC);
+
+	for (uint8_t i = 0; (i < 9) && !(PINC & (1<<PC4)); i++) {
+		_out(DDC5, DDRC); // SCL low
+		_delay_us(TWI_CLEAR_HALF_US);
+		_in(DDC5, DDRC);
+		_delay_us(TWI_CLEAR_HALF_US);
+	}
+
+	// STOP: SDA rises while SCL is high
+	_out(DDC4, DDRC);
+	_delay_us(TWI_CLEAR_HALF_US);
+	_in(DDC4, DDRC);
+	_delay_us(TWI_CLEAR_HALF_US);
+}
+
+void initPT2257() {
+    //set SCL to ?kHz
+    TWSR = (1<<TWPS1)|(0<<TWPS0); // Prescaler Value = 16
+    TWBR = 0x02;
+
+    //enable TWI
+    TWCR = (1<<TWEN);
+}
+
+/**
+ * Waits for TWINT, giving up after TWI_TIMEOUT_US (a few times that with the
+ * loop overhead at 4 MHz). On timeout (a slave holding SCL or SDA) the TWI is
+ * reset, which releases both lines.
+ */
+static bool waitTWI() {
+	for (uint16_t us = 0; us < TWI_TIMEOUT_US; us++) {
+		if (TWCR & (1<<TWINT)) {
+			return true;
+		}
+		_delay_us(1);
+	}
+
+	printf("\nTWI timeout");
+	TWCR = 0;
+	TWCR = (1<<TWEN);
+	return false;
+}
+
+/**
+ * Writes count bytes to the slave at address (SLA+W) in a single START ... STOP
+ * transaction. Returns false, after releasing the bus, if any step is not
+ * acknowledged or times out.
+ */
+bool sendTWI(uint8_t address, const uint8_t *data, uint8_t count) {
+
+	// Send START condition
+	TWCR = (1<<TWINT)|(1<<TWSTA)|(1<<TWEN);
+
+	// Wait for TWINT Flag set. This indicates that the START condition has been transmitted
+	if (!waitTWI()) {
+		muxValid = false;
+		return false;
+	}
+
+	if ((TWSR & 0xF8) != START) {
+		printf("\nFailed START");
+		muxValid = false;
+		return false;
+	}
+
+	//Load SLA_W into TWDR Register. Clear TWINT bit in TWCR to start transmission of address
+	TWDR = address;
+	TWCR = (1<<TWINT)|(1<<TWEN);
+
+	// Wait for TWINT Flag set. This indicates that the SLA+W has been transmitted, and ACK/NACK has been received.
+	if (!waitTWI()) {
+		muxValid = false;
+		return false;
+	}
+
+	if ((TWSR & 0xF8) != MT_SLA_ACK) {
+		printf("\nFailed MT_SLA_ACK");
+		TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+		muxValid = false;
+		return false;
+	}
+
+	for (uint8_t i = 0; i < count; i++) {
+		// Load DATA into TWDR Register. Clear TWINT bit in TWCR to start transmission of data
+		TWDR = data[i];
+		TWCR = (1<<TWINT)|(1<<TWEN);
+
+		// Wait for TWINT Flag set. This indicates that the DATA has been transmitted, and ACK/NACK has been received.
+		if (!waitTWI()) {
+			muxValid = false;
+			return false;
+		}
+
+		if ((TWSR & 0xF8) != MT_DATA_ACK) {
+			printf("\nFailed MT_DATA_ACK %d", i + 1);
+			TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+			muxValid = false;
+			return false;
+		}
+	}
+
+	// Transmit STOP condition
+	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+
+	return true;
+}
+
+bool sendPT2257(const uint8_t *cmd, uint8_t count) {
+	return sendTWI(PT2257_ADDR, cmd, count);
+}
+
+/**
+ * Connects the given segments (bit per channel) of the I2C switch, skipped
+ * when they are connected already. Any bus error forces the next call to
+ * write the switch again.
+ */
+bool selectTwiMux(uint8_t segments) {
+	if (muxValid && (muxSegments == segments)) {
+		return true;
+	}
+
+	if (!sendTWI(TWI_MUX_ADDR, &segments, 1)) {
+		return false;
+	}
+
+	muxSegments = segments;
+	muxValid = true;
+	return true;
+}
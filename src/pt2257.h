@@ -0,0 +1,53 @@
+#ifndef PT2257_H_
+#define PT2257_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define PT2257_ADDR  0b10001000
+#define START 		 0x08
+#define MT_SLA_ACK	 0x18   //slave ACK has been received
+#define MT_DATA_ACK	 0x28   //master ACK has been received
+
+#define PT2257_LEVEL_MAX 79 // attenuation in dB
+
+// Command bytes, tens and units of the attenuation go in the low bits
+#define PT2257_BOTH_TENS   0b11100000
+#define PT2257_BOTH_UNITS  0b11010000
+#define PT2257_LEFT_TENS   0b10110000
+#define PT2257_LEFT_UNITS  0b10100000
+#define PT2257_RIGHT_TENS  0b00110000
+#define PT2257_RIGHT_UNITS 0b00100000
+#define PT2257_MUTE        0b01111000 // | 1 mute, | 0 unmute
+#define PT2257_CLEAR       0b11000000
+
+#define PT2257_TENS(level)  (((level) / 10) & 0b0000111)
+#define PT2257_UNITS(level) ((level) % 10)
+
+#define PT2257_CMD_MAX 8 // bytes in one transaction
+
+// TCA9548A I2C switch, puts several PT2257 (fixed address) on separate segments
+#define TWI_MUX_ADDR 0b11100000
+
+// Longest wait for one TWI step (a byte is ~180 us at 50 kHz SCL), a stuck bus fails
+// the transfer instead of hanging until the watchdog resets the MCU
+#define TWI_TIMEOUT_US 2000
+
+// Half SCL period of the bus-clear clocks, ~50 kHz like the TWI
+#define TWI_CLEAR_HALF_US 10
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void clearTWIBus();
+void initPT2257();
+bool sendTWI(uint8_t address, const uint8_t *data, uint8_t count);
+bool sendPT2257(const uint8_t *cmd, uint8_t count);
+bool selectTwiMux(uint8_t segments);
+
+#endif /* PT2257_H_ */
@@ -0,0 +1,82 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include "radioprofile.h"
+#include "protocol.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define RADIO_FRAME_LEN    8   // longest frame the controllers send
+#define RADIO_SETTLE_US    130 // standby to TX/RX
+#define RADIO_ADDRESS_LEN  5
+
+/********************************************************************************
+	Profile Table
+********************************************************************************/
+static const RadioProfile radioProfiles[RADIO_PROFILE_COUNT] = {
+	// name           data rate      ARD ARC  CRC          payload
+	{ "long-range",  RF24_250KBPS,  5,  15,  RF24_CRC_16, 8 },
+	{ "balanced",    RF24_1MBPS,    1,  10,  RF24_CRC_16, 8 },
+	{ "low-latency", RF24_2MBPS,    0,  5,   RF24_CRC_8,  8 }
+};
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+const RadioProfile *getRadioProfile(uint8_t id) {
+	return (id < RADIO_PROFILE_COUNT) ? &radioProfiles[id] : 0;
+}
+
+/**
+ * Programs data rate, CRC, payload size and retry bounds of the profile.
+ * Returns false if the radio refused the data rate (250 kbps on non-P parts).
+ */
+bool applyRadioProfile(RF24 &radio, uint8_t id) {
+	const RadioProfile *profile = getRadioProfile(id);
+	if (profile == 0) {
+		return false;
+	}
+
+	if (!radio.setDataRate(profile->dataRate)) {
+		return false;
+	}
+
+	radio.setCRCLength(profile->crcLength);
+	radio.setPayloadSize(profile->payloadSize);
+	radio.setRetries(profile->retryDelay, profile->retryCount);
+	radio.setAdaptiveRetries(true, profile->retryDelay, 15, 3, profile->retryCount);
+
+	return true;
+}
+
+/**
+ * Air time in us of an Enhanced ShockBurst packet with the given payload:
+ * preamble, address, 9 bit packet control field, payload and CRC.
+ */
+static uint16_t packetAirTime(const RadioProfile *profile, uint8_t payload) {
+	uint16_t bits = 8 * (1 + RADIO_ADDRESS_LEN + payload + profile->crcLength) + 9;
+
+	switch (profile->dataRate) {
+		case RF24_250KBPS:
+			return bits * 4;
+		case RF24_2MBPS:
+			return bits / 2;
+		default:
+			return bits;
+	}
+}
+
+/**
+ * Models the timing of one controller command with the ACK payload
+ * (state reply) of the receiver.
+ */
+void modelRadioTiming(uint8_t id, RadioTiming *timing) {
+	const RadioProfile *profile = getRadioProfile(id);
+
+	timing->packet = packetAirTime(profile, RADIO_FRAME_LEN);
+	timing->ack = packetAirTime(profile, RF_STATE_REPLY_LEN);
+	timing->exchange = RADIO_SETTLE_US + timing->packet + RADIO_SETTLE_US + timing->ack;
+	timing->retry = 250 * (profile->retryDelay + 1) + timing->packet;
+	timing->worstCase = timing->exchange + profile->retryCount * timing->retry;
+}
@@ -0,0 +1,44 @@
+#ifndef RADIOPROFILE_H_
+#define RADIOPROFILE_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "../nrf24l01/RF24.h"
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef enum {
+	RADIO_PROFILE_LONG_RANGE = 0, // 250 kbps
+	RADIO_PROFILE_BALANCED,       // 1 Mbps
+	RADIO_PROFILE_LOW_LATENCY,    // 2 Mbps
+	RADIO_PROFILE_COUNT
+} RadioProfileId;
+
+typedef struct {
+	const char *name;
+	rf24_datarate_e dataRate;
+	uint8_t retryDelay;  // ARD, lower bound for the retry adaptation
+	uint8_t retryCount;  // ARC, upper bound for the retry adaptation
+	rf24_crclength_e crcLength;
+	uint8_t payloadSize; // static payload size, frames are 8 bytes at most
+} RadioProfile;
+
+typedef struct {
+	uint16_t packet;     // 8 byte frame on air, us
+	uint16_t ack;        // ACK carrying the state reply, us
+	uint16_t exchange;   // TX settling + packet + turnaround + ACK, us
+	uint16_t retry;      // extra time per retransmit, us
+	uint16_t worstCase;  // exchange with every retry used, us
+} RadioTiming;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+const RadioProfile *getRadioProfile(uint8_t id);
+bool applyRadioProfile(RF24 &radio, uint8_t id);
+void modelRadioTiming(uint8_t id, RadioTiming *timing);
+
+#endif /* RADIOPROFILE_H_ */
@@ -0,0 +1,87 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/wdt.h>
+
+#include "scanner.h"
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+// Channels the receiver (and its controllers) may move to
+static const uint8_t scanAllowedChannels[] = { 76, 100, 108, 116, 124 };
+
+// Number of passes in which each channel showed a signal
+static uint8_t channelHistogram[SCAN_CHANNELS];
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Sweeps all channels SCAN_PASSES times with minimal dwell and counts hits.
+ * The radio must not be listening and its interrupt must be masked.
+ */
+void scanChannels(RF24 &radio) {
+	for (uint8_t ch = 0; ch < SCAN_CHANNELS; ch++) {
+		channelHistogram[ch] = 0;
+	}
+
+	for (uint8_t pass = 0; pass < SCAN_PASSES; pass++) {
+		wdt_reset();
+
+		for (uint8_t ch = 0; ch < SCAN_CHANNELS; ch++) {
+			if (radio.sampleChannel(ch)) {
+				channelHistogram[ch]++;
+			}
+		}
+	}
+}
+
+/**
+ * Prints one character per channel, 32 channels per line:
+ * '.' never busy, '1'..'9' share of passes with a signal, '*' always busy.
+ */
+void printChannelHistogram() {
+	for (uint8_t ch = 0; ch < SCAN_CHANNELS; ch++) {
+		if ((ch % 32) == 0) {
+			printf("\n%03d ", ch);
+		}
+
+		uint8_t hits = channelHistogram[ch];
+		if (hits == 0) {
+			putchar('.');
+		} else if (hits >= SCAN_PASSES) {
+			putchar('*');
+		} else {
+			putchar('1' + (hits * 9 - 1) / SCAN_PASSES);
+		}
+	}
+}
+
+/**
+ * Returns the allowed channel with the fewest hits on itself and both
+ * neighbours (a 2 Mbps carrier is 2 MHz wide).
+ */
+uint8_t findQuietestChannel() {
+	uint8_t best = scanAllowedChannels[0];
+	uint16_t bestScore = 0xFFFF;
+
+	for (uint8_t i = 0; i < sizeof(scanAllowedChannels); i++) {
+		uint8_t ch = scanAllowedChannels[i];
+		uint16_t score = channelHistogram[ch] * 2;
+
+		if (ch > 0) {
+			score += channelHistogram[ch - 1];
+		}
+		if (ch < SCAN_CHANNELS - 1) {
+			score += channelHistogram[ch + 1];
+		}
+
+		if (score < bestScore) {
+			best = ch;
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
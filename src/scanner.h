@@ -0,0 +1,23 @@
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "../nrf24l01/RF24.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define SCAN_CHANNELS 126
+#define SCAN_PASSES   16 // ~25 ms per sweep, the whole scan stays below half a second
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void scanChannels(RF24 &radio);
+void printChannelHistogram();
+uint8_t findQuietestChannel();
+
+#endif /* SCANNER_H_ */
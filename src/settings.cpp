@@ -0,0 +1,109 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+
+#include "settings.h"
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+static uint8_t crc8(const uint8_t *data, uint8_t len) {
+	uint8_t crc = 0;
+	while (len--) {
+		crc = _crc_ibutton_update(crc, *data++);
+	}
+	return crc;
+}
+
+/**
+ * Reads the radio register image, false if none was saved or it is corrupted.
+ */
+bool loadRadioImage(rf24_image_t *image) {
+	eeprom_read_block(image, EEPROM_RADIO_IMAGE, sizeof(rf24_image_t));
+	uint8_t crc = eeprom_read_byte(EEPROM_RADIO_IMAGE + sizeof(rf24_image_t));
+
+	return crc == crc8((const uint8_t *) image, sizeof(rf24_image_t));
+}
+
+/**
+ * Stores the radio register image, only cells that differ are written.
+ */
+void saveRadioImage(const rf24_image_t *image) {
+	eeprom_update_block(image, EEPROM_RADIO_IMAGE, sizeof(rf24_image_t));
+	eeprom_update_byte(EEPROM_RADIO_IMAGE + sizeof(rf24_image_t), crc8((const uint8_t *) image, sizeof(rf24_image_t)));
+}
+
+/**
+ * Reads the console line setting, false if none was saved or it is corrupted.
+ * Whether the rate is usable is left to usart_configure().
+ */
+bool loadConsoleConfig(ConsoleConfig *config) {
+	eeprom_read_block(config, EEPROM_CONSOLE, sizeof(ConsoleConfig));
+	uint8_t crc = eeprom_read_byte(EEPROM_CONSOLE + sizeof(ConsoleConfig));
+
+	return crc == crc8((const uint8_t *) config, sizeof(ConsoleConfig));
+}
+
+void saveConsoleConfig(const ConsoleConfig *config) {
+	eeprom_update_block(config, EEPROM_CONSOLE, sizeof(ConsoleConfig));
+	eeprom_update_byte(EEPROM_CONSOLE + sizeof(ConsoleConfig), crc8((const uint8_t *) config, sizeof(ConsoleConfig)));
+}
+
+/**
+ * Offsets are stored as value + 128, so erased cells (0xFF) read back out of
+ * range and fall back to 0.
+ */
+static int8_t loadOffset(const uint8_t *addr) {
+	int8_t value = (int8_t) (eeprom_read_byte(addr) - 128);
+	if ((value > CHANNEL_OFFSET_MAX) || (value < -CHANNEL_OFFSET_MAX)) {
+		return 0;
+	}
+	return value;
+}
+
+void loadChannelOffsets(uint8_t zone, ChannelOffsets *offsets) {
+	uint8_t *addr = EEPROM_ZONE_OFFSETS(zone);
+	offsets->balance = loadOffset(addr);
+	offsets->trimLeft = loadOffset(addr + 1);
+	offsets->trimRight = loadOffset(addr + 2);
+}
+
+void saveChannelOffsets(uint8_t zone, const ChannelOffsets *offsets) {
+	uint8_t *addr = EEPROM_ZONE_OFFSETS(zone);
+	eeprom_update_byte(addr, (uint8_t) (offsets->balance + 128));
+	eeprom_update_byte(addr + 1, (uint8_t) (offsets->trimLeft + 128));
+	eeprom_update_byte(addr + 2, (uint8_t) (offsets->trimRight + 128));
+}
+
+/**
+ * Raw stored volume of a zone, the caller clamps it to the taper range.
+ */
+uint8_t loadZoneVolume(uint8_t zone) {
+	return eeprom_read_byte(EEPROM_ZONE_VOLUME(zone));
+}
+
+/**
+ * Only writes the cell when the volume differs.
+ */
+void saveZoneVolume(uint8_t zone, uint8_t volume) {
+	eeprom_update_byte(EEPROM_ZONE_VOLUME(zone), volume);
+}
+
+/**
+ * Power-fail write from an interrupt handler. Waits for a write in progress,
+ * writes the cell and waits for it too (at most ~6.8 ms), then restores
+ * EEAR and EEDR: an avr-libc access of the main loop interrupted between
+ * setting them and starting its own write completes as intended.
+ */
+void saveZoneVolumeFromISR(uint8_t zone, uint8_t volume) {
+	uint16_t address = EEAR;
+	uint8_t data = EEDR;
+
+	eeprom_write_byte(EEPROM_ZONE_VOLUME(zone), volume);
+	eeprom_busy_wait();
+
+	EEAR = address;
+	EEDR = data;
+}
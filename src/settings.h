@@ -0,0 +1,50 @@
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "../nrf24l01/RF24.h"
+#include "zones.h"
+
+/********************************************************************************
+	EEPROM Layout
+********************************************************************************/
+#define EEPROM_VOLUME        ((uint8_t *) 0)  // zone 0
+#define EEPROM_RADIO_PROFILE ((uint8_t *) 1)
+#define EEPROM_OFFSETS       ((uint8_t *) 2)  // zone 0 ChannelOffsets, offset binary
+#define EEPROM_CONSOLE       ((uint8_t *) 8)  // ConsoleConfig followed by its CRC
+#define EEPROM_RADIO_IMAGE   ((uint8_t *) 16) // rf24_image_t followed by its CRC
+#define EEPROM_ZONES         ((uint8_t *) 32) // zones 1.., volume followed by ChannelOffsets
+#define EEPROM_ZONE_SIZE     4
+
+// Zone 0 keeps the addresses used before there were zones
+#define EEPROM_ZONE_VOLUME(zone)  ((zone) == 0 ? EEPROM_VOLUME : EEPROM_ZONES + ((zone) - 1) * EEPROM_ZONE_SIZE)
+#define EEPROM_ZONE_OFFSETS(zone) ((zone) == 0 ? EEPROM_OFFSETS : EEPROM_ZONES + ((zone) - 1) * EEPROM_ZONE_SIZE + 1)
+
+#define CHANNEL_OFFSET_MAX 20 // balance and trim limit, volume steps
+
+/********************************************************************************
+	Types
+********************************************************************************/
+// Console line setting confirmed by the host, see the 'baud' command
+typedef struct {
+	uint32_t baud;
+	uint8_t format; // USART_FORMAT_*
+} ConsoleConfig;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+bool loadRadioImage(rf24_image_t *image);
+void saveRadioImage(const rf24_image_t *image);
+uint8_t loadZoneVolume(uint8_t zone);
+void saveZoneVolume(uint8_t zone, uint8_t volume);
+void saveZoneVolumeFromISR(uint8_t zone, uint8_t volume);
+void loadChannelOffsets(uint8_t zone, ChannelOffsets *offsets);
+void saveChannelOffsets(uint8_t zone, const ChannelOffsets *offsets);
+bool loadConsoleConfig(ConsoleConfig *config);
+void saveConsoleConfig(const ConsoleConfig *config);
+
+#endif /* SETTINGS_H_ */
@@ -0,0 +1,101 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include "taper.h"
+#include "pt2257.h"
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#else
+// Host build, tables live in ordinary memory
+#include <string.h>
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *) (addr))
+#define memcpy_P memcpy
+#endif
+
+/********************************************************************************
+	Curves
+********************************************************************************/
+// Attenuation in dB for each index of TAPER_CUSTOM, must not decrease
+static constexpr uint8_t taperCustomPoints[64] = {
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+	32, 33, 34, 35, 36, 37, 38, 39, 40, 42, 44, 46, 48, 50, 52, 54,
+	56, 58, 60, 62, 64, 66, 68, 70, 72, 74, 75, 76, 77, 78, 79, 79,
+};
+
+static constexpr uint8_t taperAttenuation(uint8_t index) {
+#if TAPER == TAPER_PERCEPTUAL
+	// i + k * i^2, scaled so the last step lands on TAPER_ATTENUATION_MAX (32 bit, 32 * 47^2 overflows int on AVR)
+	return index + (uint8_t) (((uint32_t) (TAPER_ATTENUATION_MAX - (TAPER_STEPS - 1)) * index * index
+			+ (TAPER_STEPS - 1) * (TAPER_STEPS - 1) / 2) / ((TAPER_STEPS - 1) * (TAPER_STEPS - 1)));
+#elif TAPER == TAPER_CUSTOM
+	return taperCustomPoints[index];
+#else
+	return index;
+#endif
+}
+
+// 255 * 10^(-dB/20), one dB at a time
+static constexpr double potGain(uint8_t attenuation) {
+	return attenuation == 0 ? 1.0 : 0.8912509381337456 * potGain(attenuation - 1);
+}
+
+static constexpr uint8_t potWiper(uint8_t attenuation) {
+	return (uint8_t) (255.0 * potGain(attenuation) + 0.5);
+}
+
+static constexpr bool taperMonotonic(uint8_t index) {
+	return index + 1 >= TAPER_STEPS
+			|| (taperAttenuation(index) <= taperAttenuation(index + 1) && taperMonotonic(index + 1));
+}
+
+static_assert(taperAttenuation(0) == 0, "taper must start at 0 dB");
+static_assert(taperAttenuation(TAPER_STEPS - 1) <= TAPER_ATTENUATION_MAX, "taper exceeds the PT2257 range");
+static_assert(taperMonotonic(0), "taper attenuation must not decrease");
+
+/********************************************************************************
+	Table
+********************************************************************************/
+template <uint8_t... I> struct TaperIndices {};
+template <uint8_t N, uint8_t... I> struct MakeTaperIndices : MakeTaperIndices<N - 1, N - 1, I...> {};
+template <uint8_t... I> struct MakeTaperIndices<0, I...> { typedef TaperIndices<I...> type; };
+
+typedef struct {
+	VolumeCode codes[TAPER_STEPS];
+} VolumeTable;
+
+static constexpr VolumeCode makeVolumeCode(uint8_t attenuation) {
+	return VolumeCode {
+		attenuation,
+		(uint8_t) (PT2257_BOTH_TENS | PT2257_TENS(attenuation)),
+		(uint8_t) (PT2257_BOTH_UNITS | PT2257_UNITS(attenuation)),
+		potWiper(attenuation)
+	};
+}
+
+template <uint8_t... I>
+static constexpr VolumeTable makeVolumeTable(TaperIndices<I...>) {
+	return VolumeTable { { makeVolumeCode(taperAttenuation(I))... } };
+}
+
+// Indexed by the logical volume, built at compile time for the selected TAPER
+static constexpr VolumeTable volumeTable PROGMEM = makeVolumeTable(MakeTaperIndices<TAPER_STEPS>::type());
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+void getVolumeCode(uint8_t index, VolumeCode *code) {
+	if (index >= TAPER_STEPS) {
+		index = TAPER_STEPS - 1;
+	}
+	memcpy_P(code, &volumeTable.codes[index], sizeof(VolumeCode));
+}
+
+uint8_t getVolumeAttenuation(uint8_t index) {
+	if (index >= TAPER_STEPS) {
+		index = TAPER_STEPS - 1;
+	}
+	return pgm_read_byte(&volumeTable.codes[index].attenuation);
+}
@@ -0,0 +1,51 @@
+#ifndef TAPER_H_
+#define TAPER_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+/*
+ * Taper curves, mapping the logical volume index (0 is loudest) to attenuation:
+ *
+ *   TAPER_LINEAR_DB   80 steps of 1 dB, the index is the attenuation
+ *   TAPER_PERCEPTUAL  48 steps, 1 dB at the loud end growing to ~2.3 dB at the quiet end
+ *   TAPER_CUSTOM      64 points from taperCustomPoints in taper.cpp
+ */
+#define TAPER_LINEAR_DB  0
+#define TAPER_PERCEPTUAL 1
+#define TAPER_CUSTOM     2
+
+#define TAPER TAPER_LINEAR_DB
+
+#define TAPER_ATTENUATION_MAX 79 // dB, PT2257 range
+
+#if TAPER == TAPER_PERCEPTUAL
+#define TAPER_STEPS 48
+#elif TAPER == TAPER_CUSTOM
+#define TAPER_STEPS 64
+#else
+#define TAPER_STEPS 80
+#endif
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint8_t attenuation; // dB
+	uint8_t tens;        // PT2257 both-channel bytes, ready to send
+	uint8_t units;
+	uint8_t wiper;       // digital pot position for the same attenuation, 0 beyond ~48 dB
+} VolumeCode;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void getVolumeCode(uint8_t index, VolumeCode *code);
+uint8_t getVolumeAttenuation(uint8_t index);
+
+#endif /* TAPER_H_ */
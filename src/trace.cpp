@@ -0,0 +1,64 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "trace.h"
+#include "../atmega328/mtimer.h"
+
+static_assert((TRACE_SIZE & (TRACE_SIZE - 1)) == 0, "TRACE_SIZE must be a power of two");
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+// Ring of the latest events, the oldest ones are overwritten
+static TraceEntry traceRing[TRACE_SIZE];
+static uint8_t traceNext = 0;
+static uint8_t traceCount = 0;
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+/**
+ * Records an event, from interrupts or the main loop. Costs a timebase read
+ * and a few stores.
+ */
+void traceEvent(uint8_t event, uint8_t arg) {
+	// Before cli, so an overflow due right now is still counted from the main loop
+	uint32_t time = (uint32_t) getCurrentTimeCicles();
+
+	uint8_t sreg = SREG;
+	cli();
+
+	TraceEntry *entry = &traceRing[traceNext];
+	entry->time = time;
+	entry->event = event;
+	entry->arg = arg;
+
+	traceNext = (traceNext + 1) & (TRACE_SIZE - 1);
+	if (traceCount < TRACE_SIZE) {
+		traceCount++;
+	}
+
+	SREG = sreg;
+}
+
+/**
+ * Copies up to max entries, oldest first, and returns how many.
+ */
+uint8_t readTrace(TraceEntry *entries, uint8_t max) {
+	uint8_t sreg = SREG;
+	cli();
+
+	uint8_t count = (traceCount < max) ? traceCount : max;
+	uint8_t index = (traceNext - count) & (TRACE_SIZE - 1);
+
+	for (uint8_t i = 0; i < count; i++) {
+		entries[i] = traceRing[index];
+		index = (index + 1) & (TRACE_SIZE - 1);
+	}
+
+	SREG = sreg;
+	return count;
+}
@@ -0,0 +1,42 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define TRACE_SIZE 16 // entries, power of two
+
+// Events, the argument is given per event
+#define TRACE_BOOT        0x01 // reset flags (MCUSR)
+#define TRACE_RF_COMMAND  0x02 // RfCommandType, zone in bit 7..5
+#define TRACE_DUPLICATE   0x03 // pipe
+#define TRACE_DENIED      0x04 // pipe
+#define TRACE_IR_KEY      0x05 // IR command code
+#define TRACE_BUS_ERROR   0x06 // 0
+#define TRACE_POWER_FAIL  0x07 // power fail count
+#define TRACE_HOST        0x08 // host frame type
+#define TRACE_BAUD        0x09 // USART_FORMAT_* of the new console setting, TRACE_BAUD_REVERTED
+
+#define TRACE_BAUD_REVERTED 0xFF
+
+/********************************************************************************
+	Types
+********************************************************************************/
+typedef struct {
+	uint32_t time;  // Timer 1 cicles, low 32 bits (wraps after ~12.7 days)
+	uint8_t event;  // TRACE_*
+	uint8_t arg;
+} TraceEntry;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+void traceEvent(uint8_t event, uint8_t arg);
+uint8_t readTrace(TraceEntry *entries, uint8_t max);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,102 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include "volumesink.h"
+#include "pt2257.h"
+#include "taper.h"
+#include "../atmega328/potspi.h"
+
+/********************************************************************************
+	PT2257
+********************************************************************************/
+/**
+ * Appends the byte(s) for one digit: a single both-channel byte when the two
+ * channels want the same value, else a byte for each channel that changed.
+ */
+static uint8_t encodeDigit(uint8_t *cmd, const uint8_t *want, const uint8_t *sent, bool full,
+		uint8_t both, uint8_t leftCmd, uint8_t rightCmd) {
+	bool changeLeft = full || want[0] != sent[0];
+	bool changeRight = full || want[1] != sent[1];
+	uint8_t count = 0;
+
+	if (want[0] == want[1] && (changeLeft || changeRight)) {
+		cmd[count++] = both | want[0];
+	} else {
+		if (changeLeft) {
+			cmd[count++] = leftCmd | want[0];
+		}
+		if (changeRight) {
+			cmd[count++] = rightCmd | want[1];
+		}
+	}
+
+	return count;
+}
+
+bool PT2257Sink::flush() {
+	if (!dirty) {
+		return true;
+	}
+
+	VolumeCode codeLeft, codeRight;
+	getVolumeCode(left, &codeLeft);
+	getVolumeCode(right, &codeRight);
+
+	// Table bytes address both channels, keep the digits only
+	uint8_t tens[2] = { (uint8_t) (codeLeft.tens & 0x0F), (uint8_t) (codeRight.tens & 0x0F) };
+	uint8_t units[2] = { (uint8_t) (codeLeft.units & 0x0F), (uint8_t) (codeRight.units & 0x0F) };
+
+	uint8_t cmd[PT2257_CMD_MAX];
+	uint8_t count = 0;
+
+	count += encodeDigit(&cmd[count], tens, sentTens, !cacheValid,
+			PT2257_BOTH_TENS, PT2257_LEFT_TENS, PT2257_RIGHT_TENS);
+	count += encodeDigit(&cmd[count], units, sentUnits, !cacheValid,
+			PT2257_BOTH_UNITS, PT2257_LEFT_UNITS, PT2257_RIGHT_UNITS);
+
+	if (!cacheValid || muted != sentMuted) {
+		cmd[count++] = PT2257_MUTE | (muted ? 1 : 0);
+	}
+
+	if (count > 0 && !sendPT2257(cmd, count)) {
+		// State of the chip is unknown now, stays dirty and the next flush rewrites all
+		cacheValid = false;
+		return false;
+	}
+
+	sentTens[0] = tens[0];
+	sentTens[1] = tens[1];
+	sentUnits[0] = units[0];
+	sentUnits[1] = units[1];
+	sentMuted = muted;
+	cacheValid = true;
+
+	dirty = 0;
+	return true;
+}
+
+/********************************************************************************
+	Digital Pot
+********************************************************************************/
+bool SpiPotSink::flush() {
+	if (!dirty) {
+		return true;
+	}
+
+	VolumeCode codeLeft, codeRight;
+	getVolumeCode(left, &codeLeft);
+	getVolumeCode(right, &codeRight);
+
+	uint8_t wiperLeft = muted ? 0 : codeLeft.wiper;
+	uint8_t wiperRight = muted ? 0 : codeRight.wiper;
+
+	if (wiperLeft == wiperRight) {
+		potWrite(POT_WORD(POT_SELECT_0 | POT_SELECT_1, wiperLeft));
+	} else {
+		potWrite(POT_WORD(POT_SELECT_0, wiperLeft));
+		potWrite(POT_WORD(POT_SELECT_1, wiperRight));
+	}
+
+	dirty = 0;
+	return true;
+}
@@ -0,0 +1,181 @@
+#ifndef VOLUMESINK_H_
+#define VOLUMESINK_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "taper.h"
+#include "pt2257.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define SINK_LEVEL_MAX (TAPER_STEPS - 1) // logical volume index, 0 is loudest
+
+#define SINK_DIRTY_LEVEL 0x01
+#define SINK_DIRTY_MUTE  0x02
+
+/********************************************************************************
+	Volume Sinks
+********************************************************************************/
+/*
+ * A volume sink is any class with
+ *
+ *   void setLevel(uint8_t level);               both channels, index into the taper table
+ *   void setChannels(uint8_t left, uint8_t right);
+ *   void setMute(bool mute);
+ *   bool flush();                               false if the device did not take it
+ *
+ * The setters only stage the change, flush() sends everything staged since
+ * the last flush to the device. Sinks are picked by template parameter, so the
+ * calls are resolved at compile time and there is no vtable.
+ */
+
+/**
+ * Holds the staged state shared by the device sinks.
+ */
+class SinkState {
+public:
+	void setLevel(uint8_t level) {
+		setChannels(level, level);
+	}
+
+	void setChannels(uint8_t left, uint8_t right) {
+		this->left = left < SINK_LEVEL_MAX ? left : SINK_LEVEL_MAX;
+		this->right = right < SINK_LEVEL_MAX ? right : SINK_LEVEL_MAX;
+		dirty |= SINK_DIRTY_LEVEL;
+	}
+
+	void setMute(bool mute) {
+		muted = mute;
+		dirty |= SINK_DIRTY_MUTE;
+	}
+
+	bool isDirty() const {
+		return dirty != 0;
+	}
+
+protected:
+	uint8_t left = SINK_LEVEL_MAX;
+	uint8_t right = SINK_LEVEL_MAX;
+	bool muted = false;
+	uint8_t dirty = 0;
+};
+
+/**
+ * PT2257 over TWI, one bus transaction per flush. The chip takes the tens and
+ * units bytes independently, so once a write has been acknowledged only the
+ * digits that changed are sent. A bus error drops that cache and the next
+ * flush rewrites everything.
+ */
+class PT2257Sink : public SinkState {
+public:
+	bool flush();
+
+	void invalidate() {
+		cacheValid = false;
+	}
+
+private:
+	// Last acknowledged attenuation digits per channel, and the mute state
+	uint8_t sentTens[2];
+	uint8_t sentUnits[2];
+	bool sentMuted;
+	bool cacheValid = false;
+};
+
+/**
+ * A sink behind segment channel of the TCA9548A switch, so several PT2257
+ * (which have a fixed address) can share the bus. The switch is only written
+ * when a flush has something to send and another segment was selected.
+ */
+template <class Sink, uint8_t channel>
+class MuxedSink : public Sink {
+public:
+	bool flush() {
+		if (!this->isDirty()) {
+			return true;
+		}
+		if (!selectTwiMux(1 << channel)) {
+			return false; // stays dirty, the chip itself was not touched
+		}
+		return Sink::flush();
+	}
+};
+
+/**
+ * Dual digital pot over the driver selected by POT_DRIVER, one word per pot
+ * (one word for both when the channels match). Mute parks the wipers at 0.
+ */
+class SpiPotSink : public SinkState {
+public:
+	bool flush();
+};
+
+/**
+ * Accepts and drops everything, for builds without an output stage.
+ */
+class NullSink {
+public:
+	void setLevel(uint8_t) {}
+	void setChannels(uint8_t, uint8_t) {}
+	void setMute(bool) {}
+	bool flush() { return true; }
+};
+
+/**
+ * Remembers what reached flush() and how often, for the console and for
+ * checking the command path without hardware.
+ */
+class RecordingSink : public SinkState {
+public:
+	bool flush() {
+		if (dirty) {
+			flushedLeft = left;
+			flushedRight = right;
+			flushedMuted = muted;
+			flushes++;
+			dirty = 0;
+		}
+		return true;
+	}
+
+	uint8_t flushedLeft = SINK_LEVEL_MAX;
+	uint8_t flushedRight = SINK_LEVEL_MAX;
+	bool flushedMuted = false;
+	uint16_t flushes = 0;
+};
+
+/**
+ * Drives two sinks with every update, nest it for more.
+ * Both sinks are flushed even if the first one fails.
+ */
+template <class First, class Second>
+class CompositeSink {
+public:
+	void setLevel(uint8_t level) {
+		first.setLevel(level);
+		second.setLevel(level);
+	}
+
+	void setChannels(uint8_t left, uint8_t right) {
+		first.setChannels(left, right);
+		second.setChannels(left, right);
+	}
+
+	void setMute(bool mute) {
+		first.setMute(mute);
+		second.setMute(mute);
+	}
+
+	bool flush() {
+		bool ok = first.flush();
+		return second.flush() && ok;
+	}
+
+	First first;
+	Second second;
+};
+
+#endif /* VOLUMESINK_H_ */
@@ -0,0 +1,81 @@
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <util/crc16.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "warmstate.h"
+
+/********************************************************************************
+	Global Variables
+********************************************************************************/
+static WarmState warmState __attribute__ ((section (".noinit")));
+static uint8_t resetFlags __attribute__ ((section (".noinit")));
+
+/********************************************************************************
+	Reset Cause
+********************************************************************************/
+/**
+ * Saves and clears MCUSR before main() runs. The watchdog stays enabled
+ * (at its shortest timeout) after a watchdog reset, so it is turned off
+ * here before it can fire again during startup.
+ */
+void captureResetFlags(void) __attribute__ ((naked, used, section (".init3")));
+
+void captureResetFlags(void) {
+	resetFlags = MCUSR;
+	MCUSR = 0;
+	wdt_disable();
+}
+
+/********************************************************************************
+	Functions
+********************************************************************************/
+static uint8_t warmStateCrc(const WarmState *state) {
+	const uint8_t *data = (const uint8_t *) state;
+	uint8_t crc = 0;
+
+	for (uint8_t i = 0; i < offsetof(WarmState, crc); i++) {
+		crc = _crc_ibutton_update(crc, data[i]);
+	}
+	return crc;
+}
+
+uint8_t getResetFlags() {
+	return resetFlags;
+}
+
+/**
+ * Returns the state kept across the last reset, if the reset was a warm one
+ * (watchdog, external or software) and the block is intact. After power-on
+ * or brown-out the RAM content is meaningless.
+ */
+bool loadWarmState(WarmState *state) {
+	if (resetFlags & (_BV(PORF) | _BV(BORF))) {
+		return false;
+	}
+
+	if ((warmState.magic != WARM_STATE_MAGIC) || (warmState.crc != warmStateCrc(&warmState))) {
+		return false;
+	}
+
+	memcpy(state, &warmState, sizeof(WarmState));
+	return true;
+}
+
+void saveWarmState(const WarmState *state) {
+	memcpy(&warmState, state, sizeof(WarmState));
+	warmState.magic = WARM_STATE_MAGIC;
+	warmState.crc = warmStateCrc(&warmState);
+}
+
+/**
+ * Resets the MCU through the watchdog, the state block is kept.
+ */
+void softwareReset() {
+	wdt_enable(WDTO_15MS);
+	while (1);
+}
@@ -0,0 +1,36 @@
+#ifndef WARMSTATE_H_
+#define WARMSTATE_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+#include "zones.h"
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+#define WARM_STATE_MAGIC 0x5A3D
+
+/********************************************************************************
+	Types
+********************************************************************************/
+// Survives watchdog, external and software resets in .noinit RAM
+typedef struct {
+	uint16_t magic;
+	uint8_t volume[ZONE_COUNT];
+	uint8_t mutedZones; // bit per zone
+	uint8_t stateVersion;
+	uint8_t radioChannel;
+	uint8_t crc;
+} WarmState;
+
+/********************************************************************************
+Function Prototypes
+********************************************************************************/
+uint8_t getResetFlags();
+bool loadWarmState(WarmState *state);
+void saveWarmState(const WarmState *state);
+void softwareReset();
+
+#endif /* WARMSTATE_H_ */
@@ -0,0 +1,90 @@
+#ifndef ZONES_H_
+#define ZONES_H_
+
+/********************************************************************************
+Includes
+********************************************************************************/
+#include <stdint.h>
+
+/********************************************************************************
+	Macros and Defines
+********************************************************************************/
+// Independent volume zones served by this receiver, at most 8 (see WarmState)
+#define ZONE_COUNT 1
+
+static_assert(ZONE_COUNT <= 8, "WarmState.mutedZones has a bit per zone, TRACE_RF_COMMAND 3 bits for it");
+
+/********************************************************************************
+	Types
+********************************************************************************/
+// Added to the volume per channel, positive values attenuate
+typedef struct {
+	int8_t balance;   // > 0 attenuates the left channel, < 0 the right one
+	int8_t trimLeft;
+	int8_t trimRight;
+} ChannelOffsets;
+
+typedef struct {
+	uint8_t volume;
+	uint8_t savedVolume;  // what EEPROM holds, the volume is saved when they differ
+	bool muted;
+	ChannelOffsets offsets;
+	bool changed;         // has to be sent to its sink
+	bool offsetsChanged;  // has to be saved to EEPROM, by the deferred save job
+} ZoneState;
+
+/********************************************************************************
+	Zone Sinks
+********************************************************************************/
+/**
+ * One volume sink per zone, zone 0 is the first type. The zone index is
+ * resolved by recursion at compile time when it is a constant and by a
+ * chain of compares otherwise, there is no vtable either way.
+ * flush() walks all zones in one pass, sinks with nothing staged skip the bus.
+ * Every sink that has something staged still sends its own transaction.
+ */
+template <class... Sinks>
+class ZoneSinks;
+
+template <>
+class ZoneSinks<> {
+public:
+	static const uint8_t count = 0;
+
+	void setChannels(uint8_t, uint8_t, uint8_t) {}
+	void setMute(uint8_t, bool) {}
+	bool flush() { return true; }
+};
+
+template <class Head, class... Tail>
+class ZoneSinks<Head, Tail...> {
+public:
+	static const uint8_t count = 1 + sizeof...(Tail);
+
+	void setChannels(uint8_t zone, uint8_t left, uint8_t right) {
+		if (zone == 0) {
+			head.setChannels(left, right);
+		} else {
+			tail.setChannels(zone - 1, left, right);
+		}
+	}
+
+	void setMute(uint8_t zone, bool mute) {
+		if (zone == 0) {
+			head.setMute(mute);
+		} else {
+			tail.setMute(zone - 1, mute);
+		}
+	}
+
+	bool flush() {
+		bool ok = head.flush();
+		return tail.flush() && ok;
+	}
+
+private:
+	Head head;
+	ZoneSinks<Tail...> tail;
+};
+
+#endif /* ZONES_H_ */